@@ -18,403 +18,338 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
 #include <getopt.h>
 #include <SDL2/SDL.h>
 #include "sdr.h"
+#include "usbtv.h"
+#include "fm.h"
+#include "tnr.h"
+#include "detect.h"
+#include "scope.h"
+#include "shmring.h"
+#include "latency.h"
+#include "batch.h"
+#include "governor.h"
+#include "iqz.h"
 
-typedef struct {
-	
-	uint32_t sample_rate;
-	
-	int colour;
-	
-	int lines;
-	int active_lines;
-	
-	int width;
-	
-	int hsync_width;
-	int vsync_width;
-	
-	int active_left;
-	int active_width;
-	
-	int fsc_left;
-	int fsc_width;
-	
-	int frame_rate_num;
-	int frame_rate_den;
-	
-	int frame;
-	int line;
-	
-	int fsc;
-	int fsc_hold;
-	
-	const int16_t *in;
-	int in_len;
-	
-	int16_t *iline;
-	int iline_len;
-	
-	int32_t hsync;
-	int16_t *hsyncwin;
-	int hsyncwin_x;
-	int hsync_offset;
-	
-	int vsync;
-	int vsync_count;
-	
-	int sync_level;
-	int blank_level;
-	int black_level;
-	int white_level;
-	
-	uint32_t *framebuffer;
-	int framebuffer_len;
-	
-} _usbtv_t;
-
-/* Unified S-Band TV Decoder */
-void _usbtv_free(_usbtv_t *s)
+static void _print_usage(void)
 {
-	free(s->framebuffer);
-	free(s->hsyncwin);
-	free(s->iline);
+	return;
 }
 
-int _usbtv_init(_usbtv_t *s, uint32_t sample_rate, int colour)
+static int16_t *_autodetect(sdr_t *sdr, int *len, uint32_t *sample_rate, int *colour, int auto_rate, double deviation)
 {
-	memset(s, 0, sizeof(_usbtv_t));
-	
-	s->sample_rate = sample_rate;
-	s->colour = colour != 0;
+	detect_result_t best;
+	int16_t *iq;
+	int r;
 	
-	if(s->colour)
+	iq = detect_sdr(sdr, len, &best, &r, *sample_rate, auto_rate, deviation);
+	if(!iq)
 	{
-		/* 525 line 30/1.001 fps interlaced field-sequential colour */
-		s->lines = 525;
-		s->active_lines = 480;
-		s->frame_rate_num = 30000;
-		s->frame_rate_den =  1001;
-		
-		s->hsync_width  = round(s->sample_rate * 0.00000470); /* 4.70 ±1.00µs */
-		s->vsync_width  = round(s->sample_rate * 0.00002710); /* 27.10 µs */
-		
-		s->active_left  = round(s->sample_rate * 0.00000920); /* |-->| 9.20µs */
-		s->active_width = ceil(s->sample_rate *  0.00005290); /* 52.90µs */
-		
-		s->fsc_left  = round(s->sample_rate * 0.00001470); /* |-->| 14.70µs */
-		s->fsc_width = round(s->sample_rate * 0.00002000); /* 20.00µs */
+		return(NULL);
 	}
-	else
+	
+	if(!r)
 	{
-		/* 320 line 10 fps progressive mono */
-		s->lines = 320;
-		s->active_lines = 312;
-		s->frame_rate_num = 10;
-		s->frame_rate_den = 1;
+		fprintf(stderr, "Unable to detect the video standard, using defaults.\n");
 		
-		s->hsync_width  = round(s->sample_rate * 0.00002000); /* 20.00µs */
-		s->vsync_width  = round(s->sample_rate * 0.00026750); /* 267.5µs */
+		if(auto_rate) *sample_rate = 2250000;
+		if(*colour < 0) *colour = 0;
 		
-		s->active_left  = round(s->sample_rate * 0.00002500); /* |-->| 25.0µs */
-		s->active_width = ceil(s->sample_rate * 0.00028250); /* 282.5µs */
-	}
-	
-	s->width = round((double) s->sample_rate / s->lines / ((double) s->frame_rate_num / s->frame_rate_den));
-	
-	if(s->active_width > s->width)
-	{
-		s->active_width = s->width;
+		return(iq);
 	}
 	
-	s->iline_len = 0;
-	s->iline = malloc(s->width * sizeof(int16_t));
-	if(!s->iline)
-	{
-		perror("malloc");
-		_usbtv_free(s);
-		return(-1);
-	}
-	
-	s->hsync = 0;
-	s->hsyncwin_x = 0;
-	s->hsyncwin = calloc(s->hsync_width, sizeof(int16_t));
-	if(!s->hsyncwin)
-	{
-		perror("calloc");
-		_usbtv_free(s);
-		return(-1);
-	}
+	fprintf(stderr, "Detected %s at %d Hz (lock quality %.0f%%)\n",
+		best.colour ? "colour" : "mono", best.sample_rate, best.score * 100
+	);
 	
-	s->framebuffer_len = s->active_width * s->active_lines;
-	s->framebuffer = malloc(s->framebuffer_len * sizeof(uint32_t));
-	if(!s->framebuffer)
-	{
-		perror("malloc");
-		_usbtv_free(s);
-		return(-1);
-	}
+	*sample_rate = best.sample_rate;
+	*colour = best.colour;
 	
-	s->frame = 1;
-	s->line = 1;
-	s->fsc = 0;
-	s->fsc_hold = 0;
+	return(iq);
+}
+
+typedef struct {
+	double hsync;
+	double vsync;
+	int lines;
+} _bench_t;
+
+static void _bench_line(void *user, const usbtv_line_t *line)
+{
+	_bench_t *b = user;
 	
-	fprintf(stderr, "Video: %dx%d %.2f fps (full frame %dx%d)\n",
-		s->active_width, s->active_lines, (double) s->frame_rate_num / s->frame_rate_den,
-		s->width, s->lines
-	);
+	b->hsync += line->hsync_confidence;
+	b->vsync += line->vsync_confidence;
+	b->lines++;
+}
+
+static double _elapsed(const struct timespec *start)
+{
+	struct timespec now;
 	
-	fprintf(stderr, "Sample rate: %d\n", s->sample_rate);
+	clock_gettime(CLOCK_MONOTONIC, &now);
 	
-	return(0);
+	return((now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9);
 }
 
-int _usbtv_read(_usbtv_t *s)
+/* The share of the line period the sync detector may use */
+#define _SYNC_BUDGET 0.1
+
+static int _bench(sdr_t *sdr, const int16_t *pre, int pre_len, uint32_t sample_rate, int colour, double deviation, double seconds)
 {
-	int aline;
-	int x;
-	int mx;
-	int ref;
-	
-	while(s->iline_len < s->width)
+	struct timespec start;
+	fm_demod_t fm;
+	usbtv_t tv;
+	_bench_t b;
+	int16_t *iq, *demod;
+	int samples, len, r, n;
+	double t_fm, t_tv, t_sync, budget, quality;
+	
+	/* Read the test samples into memory first, so
+	 * only the demodulator and decoder are timed */
+	samples = sample_rate * seconds;
+	
+	iq = malloc(samples * 2 * sizeof(int16_t));
+	demod = malloc(samples * sizeof(int16_t));
+	if(!iq || !demod)
 	{
-		if(s->hsync_offset < 0)
-		{
-			s->iline_len++;
-			s->hsync_offset++;
-			continue;
-		}
-		else if(s->iline_len > 0 && s->hsync_offset > 0)
-		{
-			s->iline_len--;
-			s->hsync_offset--;
-			continue;
-		}
-		
-		if(s->in_len == 0) return(2);
-		
-		s->iline[s->iline_len] = *s->in;
-		
-		s->iline_len++;
-		s->in++;
-		s->in_len--;
+		perror("malloc");
+		free(iq);
+		free(demod);
+		return(-1);
 	}
 	
-	s->iline_len = 0;
+	len = (pre_len < samples ? pre_len : samples);
+	memcpy(iq, pre, len * 2 * sizeof(int16_t));
 	
-	/* Scan for hsync */
-	mx = 0;
-	ref = s->hsync;
-	for(x = 0; x < s->width; x++)
+	for(; len < samples; len += r)
 	{
-		/* Update the sync counter and window */
-		s->hsync -= s->hsyncwin[s->hsyncwin_x];
-		s->hsync += s->hsyncwin[s->hsyncwin_x] = s->iline[x];
-		
-		s->hsyncwin_x++;
-		if(s->hsyncwin_x == s->hsync_width)
-		{
-			s->hsyncwin_x = 0;
-		}
+		r = samples - len;
+		if(r > 1024) r = 1024;
 		
-		if(s->hsync < ref)
-		{
-			mx = x;
-			ref = s->hsync;
-		}
+		r = sdr_read(sdr, iq + len * 2, r);
+		if(r <= 0) break;
 	}
 	
-	ref = mx - s->hsync_width + 1;
-	if(ref < -s->width / 2) ref += s->width;
-	if(ref >= s->width / 2) ref -= s->width;
-	
-	if(ref < 0) s->hsync_offset--;
-	if(ref > 0) s->hsync_offset++;
-	
-	/* Update the sync level */
-	ref = s->iline[1];
-	for(x = 2; x < s->hsync_width - 1; x++)
+	if(usbtv_init(&tv, sample_rate, colour) != 0)
 	{
-		ref += s->iline[x];
+		fprintf(stderr, "Error initialising decoder.\n");
+		free(iq);
+		free(demod);
+		return(-1);
 	}
-	ref /= s->hsync_width - 2;
 	
-	s->sync_level = (s->sync_level * 99 + ref) / 100;
-	s->blank_level = s->sync_level + (INT16_MAX * 0.3);
+	memset(&b, 0, sizeof(b));
+	usbtv_set_callbacks(&tv, _bench_line, NULL, &b);
+	fm_demod_init(&fm, sample_rate, deviation);
 	
-	/* Calculate the black and white levels */
-	if(s->colour)
-	{
-		s->black_level = s->sync_level + (INT16_MAX * 0.3525);
-	}
-	else
-	{
-		s->black_level = s->sync_level + (INT16_MAX * 0.3);
-	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	fm_demod(&fm, demod, iq, len);
+	t_fm = _elapsed(&start);
 	
-	s->white_level = s->sync_level + (INT16_MAX * 1.0);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	usbtv_push(&tv, demod, len);
+	t_tv = _elapsed(&start);
 	
-	/* Scan for vsync */
-	aline = 0;
+	quality = usbtv_lock_quality(&tv);
 	
-	ref = s->iline[0];
-	for(x = 1; x < s->vsync_width; x++)
+	/* Then the sync detector on its own, with a fresh decoder */
+	usbtv_free(&tv);
+	if(usbtv_init(&tv, sample_rate, colour) != 0)
 	{
-		ref += s->iline[x];
+		fprintf(stderr, "Error initialising decoder.\n");
+		free(iq);
+		free(demod);
+		return(-1);
 	}
-	ref /= s->vsync_width;
-	ref -= s->blank_level;
 	
-	s->vsync <<= 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	n = usbtv_sync_only(&tv, demod, len);
+	t_sync = _elapsed(&start);
 	
-	if(ref < -0.15 * INT16_MAX)
-	{
-		s->vsync |= 1;
-	}
+	/* Per line, against the time each line takes to arrive */
+	budget = 1e9 * tv.frame_rate_den / tv.frame_rate_num / tv.lines;
 	
-	if(s->colour)
+	if(b.lines > 0)
 	{
-		x = s->width / 2;
-		ref = s->iline[x];
-		for(; x < s->width / 2 + s->vsync_width; x++)
-		{
-			ref += s->iline[x];
-		}
-		ref /= s->vsync_width;
-		ref -= s->blank_level;
-		
-		s->vsync <<= 1;
-		
-		if(ref < -0.15 * INT16_MAX)
-		{
-			s->vsync |= 1;
-		}
-		
-		s->vsync &= 0xFFFF;
-		
-		if(s->vsync == 252) aline = 7;
-		else if(s->vsync == 126) aline = 269;
+		fprintf(stderr, "Samples: %d (%.2f seconds)\n", len, (double) len / sample_rate);
+		fprintf(stderr, "FM demodulator: %.0f ns/line\n", t_fm * 1e9 / b.lines);
+		fprintf(stderr, "Decoder: %.0f ns/line\n", t_tv * 1e9 / b.lines);
+		fprintf(stderr, "Line period: %.0f ns (%.1f%% used)\n", budget, (t_fm + t_tv) * 1e9 / b.lines / budget * 100);
+		fprintf(stderr, "Sync detector: %.0f ns/line (%.1f%% used, budget %.0f%%)\n", t_sync * 1e9 / n, t_sync * 1e9 / n / budget * 100, _SYNC_BUDGET * 100);
+		fprintf(stderr, "Lock quality: %.1f%%\n", quality * 100);
+		fprintf(stderr, "Sync confidence: hsync %.2f, vsync %.2f\n", b.hsync / b.lines, b.vsync / b.lines);
 	}
 	else
 	{
-		s->vsync &= 0x3FF;
-		if(s->vsync == 510) aline = 9;
+		fprintf(stderr, "No lines decoded.\n");
 	}
 	
-	if(aline)
-	{
-		s->line = aline;
-		s->vsync_count = s->lines * 10;
-	}
+	/* Fail if decoding is slower than real time, or the
+	 * sync detector takes more than its share of a line */
+	r = (b.lines > 0 && (t_fm + t_tv) * 1e9 / b.lines <= budget && t_sync * 1e9 / n <= budget * _SYNC_BUDGET ? 0 : 1);
 	
-	s->vsync_count += (s->vsync_count ? -1 : 0);
+	usbtv_free(&tv);
+	free(iq);
+	free(demod);
+	
+	return(r);
+}
+
+/* Times for recent blocks of input, to look up the latency of each
+ * frame by its sample index. This covers about half a second */
+#define _TRACE_LEN 1024
+
+typedef struct {
+	int64_t sample;         /* Input index of the block's first sample */
+	int64_t arrive;         /* Arrival at the SDR */
+	int64_t read;           /* Returned by sdr_read() */
+	int64_t demod;          /* FM demodulated */
+} _trace_t;
+
+enum {
+	_LAT_BUFFER,            /* Arrival to read */
+	_LAT_DEMOD,             /* Read to demodulated */
+	_LAT_DECODE,            /* Demodulated to frame complete */
+	_LAT_OUTPUT,            /* Frame complete to presented or published */
+	_LAT_LAST_LINE,         /* End to end, for the last line */
+	_LAT_FIRST_LINE,        /* End to end, for the first line */
+	_LAT_NEWEST_LINE,       /* End to end, for the newest line at each update */
+	_LAT_STAGES,
+};
+
+static const char *_lat_names[_LAT_STAGES] = {
+	"buffer", "demod", "decode", "output", "last line", "first line",
+	"newest line",
+};
+
+static const _trace_t *_trace_find(const _trace_t *trace, int64_t pos, int64_t sample)
+{
+	int64_t i;
 	
-	/* Update FSC counter */
-	if(s->colour)
+	/* The newest block starting at or before sample */
+	for(i = pos - 1; i >= 0 && i >= pos - _TRACE_LEN; i--)
 	{
-		if(s->line == 1 || s->line == 264)
-		{
-			s->fsc++;
-			s->fsc %= 3;
-			if(s->fsc == 1) s->fsc_hold = 0;
-		}
-		
-		/* Detect the FSC flag. The hold function forces at
-		 * at least one full cycle between each FSC reset. */
-		
-		if(!s->fsc_hold && (s->line == 18 || s->line == 281))
+		if(trace[i % _TRACE_LEN].sample <= sample)
 		{
-			ref = 0;
-			
-			for(x = s->fsc_left; x < s->fsc_left + s->fsc_width; x++)
-			{
-				ref += s->iline[x];
-			}
-			
-			ref /= s->fsc_width;
-			
-			if(ref > (s->white_level + s->black_level) / 2)
-			{
-				s->fsc = 1;
-				s->fsc_hold = 1;
-			}
+			return(&trace[i % _TRACE_LEN]);
 		}
-		
-		aline = (s->line < 265 ? (s->line - 23) * 2 : (s->line - 286) * 2 + 1);
 	}
-	else
+	
+	return(NULL);
+}
+
+static void _trace_frame(latency_t *lat, const _trace_t *trace, int64_t pos, const usbtv_frame_t *f, int64_t decoded, int64_t output)
+{
+	const _trace_t *first, *last;
+	
+	first = _trace_find(trace, pos, f->first_sample);
+	last = _trace_find(trace, pos, f->last_sample);
+	if(!first || !last) return;
+	
+	latency_add(&lat[_LAT_BUFFER], last->read - last->arrive);
+	latency_add(&lat[_LAT_DEMOD], last->demod - last->read);
+	latency_add(&lat[_LAT_DECODE], decoded - last->demod);
+	latency_add(&lat[_LAT_OUTPUT], output - decoded);
+	latency_add(&lat[_LAT_LAST_LINE], output - last->arrive);
+	latency_add(&lat[_LAT_FIRST_LINE], output - first->arrive);
+}
+
+static void _trace_line(latency_t *lat, const _trace_t *trace, int64_t pos, int64_t sample, int64_t output)
+{
+	const _trace_t *t = _trace_find(trace, pos, sample);
+	
+	if(t)
 	{
-		aline = s->line - 9;
+		latency_add(&lat[_LAT_NEWEST_LINE], output - t->arrive);
 	}
+}
+
+/* Upload rows of the picture to the texture */
+static void _upload(SDL_Texture *texture, const usbtv_t *tv, const uint8_t *frame, const uint8_t *chroma, int chroma_pitch, int first, int rows)
+{
+	const int stride = tv->active_width * tv->bytes_per_pixel;
+	SDL_Rect r;
 	
-	if(aline >= 0 && aline < s->active_lines)
+	if(!tv->colour)
 	{
-		uint32_t c;
-		int v;
-		int x;
-		
-		for(x = 0; x < s->active_width; x++)
-		{
-			v = s->iline[s->active_left + x] - s->black_level;
-			v = v * 255 / (s->white_level - s->black_level);
-			v = (v > 0xFF ? 0xFF : (v < 0x00 ? 0x00 : v));
-			
-			if(s->colour)
-			{
-				c = s->framebuffer[aline * s->active_width + x];
-				
-				c &= ~(0xFF << (s->fsc * 8));
-				c |= v << (s->fsc * 8);
-			}
-			else
-			{
-				c = v << 16 | v << 8 | v;
-			}
-			
-			s->framebuffer[aline * s->active_width + x] = c;
-		}
+		/* The chroma planes are subsampled, so keep to pairs of rows */
+		rows += first & 1;
+		first &= ~1;
+		rows += rows & 1;
+		if(first + rows > tv->active_lines) rows = tv->active_lines - first;
 	}
 	
-	s->line++;
+	r.x = 0;
+	r.y = first;
+	r.w = tv->active_width;
+	r.h = rows;
 	
-	if(s->line > s->lines)
+	if(tv->colour)
 	{
-		s->line = 1;
-		s->frame++;
-		
-		return(1);
+		SDL_UpdateTexture(texture, &r, frame + first * stride, stride);
 	}
+	else
+	{
+		chroma += first / 2 * chroma_pitch;
+		SDL_UpdateYUVTexture(texture, &r, frame + first * stride, stride, chroma, chroma_pitch, chroma, chroma_pitch);
+	}
+}
+
+static void _render(SDL_Renderer *renderer, SDL_Texture *texture, SDL_Texture *overlay, const SDL_Rect *overlay_rect)
+{
+	SDL_RenderClear(renderer);
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
 	
-	/* In colour mode, signal to update the frame each field */
-	if(s->colour && s->line == 264)
+	if(overlay)
 	{
-		return(1);
+		SDL_RenderCopy(renderer, overlay, NULL, overlay_rect);
 	}
 	
-	return(0);
+	SDL_RenderPresent(renderer);
 }
 
-int _usbtv_write(_usbtv_t *s, const int16_t *buf, int samples)
+/* Frames held in the shared memory ring */
+#define _SHM_SLOTS 4
+
+static volatile sig_atomic_t _quit = 0;
+
+static void _sigint_handler(int sig)
 {
-	s->in = buf;
-	s->in_len = samples;
-	
-	return(0);
+	_quit = 1;
 }
 
-static void _print_usage(void)
+static volatile sig_atomic_t _report = 0;
+
+static void _sigusr1_handler(int sig)
 {
-	return;
+	_report = 1;
 }
 
+enum {
+	_OPT_FASTFORWARD = 1000,
+	_OPT_NR,
+	_OPT_NR_MODE,
+	_OPT_SCOPE,
+	_OPT_AFC,
+	_OPT_BENCH,
+	_OPT_HEADLESS,
+	_OPT_SHM,
+	_OPT_BATCH,
+	_OPT_GOVERNOR,
+	_OPT_RECORD,
+	_OPT_SCANLINE,
+};
+
 int main(int argc, char *argv[])
 {
 	SDL_Window *window;
 	SDL_Renderer *renderer;
-	SDL_Texture *texture;
+	SDL_Texture *texture = NULL;
 	SDL_Event event;
 	unsigned int timer;
 	int c;
@@ -433,16 +368,78 @@ int main(int argc, char *argv[])
 		{ "ppm",        required_argument, 0, 'p' },
 		{ "type",       required_argument, 0, 't' },
 		{ "fullscreen", no_argument,       0, 'F' },
+		{ "fastforward", no_argument,      0, _OPT_FASTFORWARD },
+		{ "nr",         required_argument, 0, _OPT_NR },
+		{ "nr-mode",    required_argument, 0, _OPT_NR_MODE },
+		{ "scope",      required_argument, 0, _OPT_SCOPE },
+		{ "afc",        no_argument,       0, _OPT_AFC },
+		{ "bench",      required_argument, 0, _OPT_BENCH },
+		{ "headless",   no_argument,       0, _OPT_HEADLESS },
+		{ "shm",        required_argument, 0, _OPT_SHM },
+		{ "batch",      required_argument, 0, _OPT_BATCH },
+		{ "governor",   no_argument,       0, _OPT_GOVERNOR },
+		{ "record",     required_argument, 0, _OPT_RECORD },
+		{ "scanline",   no_argument,       0, _OPT_SCANLINE },
 		{ 0,            0,                 0,  0  }
 	};
 	int done;
 	int colour = 0;
+	int auto_rate = 0;
+	int16_t *pre = NULL;
+	int pre_len = 0;
+	int pre_pos = 0;
 	int fullscreen = 0;
+	int fastforward = 0;
+	int pending = 0;
+	int nr_frames = 0;
+	int nr_mode = TNR_STACK;
+	tnr_t tnr;
+	int scope_rate = 0;
+	int scope_show = 1;
+	scope_t scope;
+	SDL_Texture *overlay = NULL;
+	SDL_Rect overlay_rect;
+	const uint32_t *p;
+	const void *frame;
+	uint8_t *chroma = NULL;
+	int chroma_pitch = 0;
+	int afc = 0;
+	double offset;
+	double bench = 0;
+	int headless = 0;
+	char *shm_name = NULL;
+	shmring_t shm;
+	batch_opts_t batch = { .workers = 0 };
+	int governor = 0;
+	governor_t gov;
+	int gov_phase = 0;
+	int64_t gov_dropped = 0;
+	int64_t gov_idle = 0;
+	int64_t gov_last;
+	int64_t now;
+	char *record = NULL;
+	iqz_writer_t rec;
+	int scanline = 0;
+	int eof = 0;
+	SDL_DisplayMode mode;
+	unsigned int refresh = 0;
+	int refresh_ms = 0;
+	int first, rows;
+	int live = 0;
+	int64_t pace = 0;
+	int64_t due;
+	_trace_t trace[_TRACE_LEN];
+	_trace_t *t;
+	int64_t trace_pos = 0;
+	int64_t in_pos = 0;
+	latency_t lat[_LAT_STAGES];
+	usbtv_frame_t lf;
+	int64_t decoded = 0;
 	sdr_t sdr;
-	_usbtv_t tv;
+	usbtv_t tv;
 	int r;
 	int tpf;
-	double fm = 0;
+	fm_demod_t fm;
 	
 	/* Temp buffer */
 	int16_t buf[1024 * 2];
@@ -462,6 +459,10 @@ int main(int argc, char *argv[])
 			{
 				colour = 1;
 			}
+			else if(strcmp(optarg, "auto") == 0)
+			{
+				colour = -1;
+			}
 			else
 			{
 				fprintf(stderr, "Unrecognised mode '%s'.\n", optarg);
@@ -475,8 +476,9 @@ int main(int argc, char *argv[])
 			device = strdup(optarg);
 			break;
 		
-		case 's': /* -s, --samplerate <value> */
-			sample_rate = atol(optarg);
+		case 's': /* -s, --samplerate <value|auto> */
+			auto_rate = (strcmp(optarg, "auto") == 0);
+			sample_rate = (auto_rate ? 2250000 : atol(optarg));
 			break;
 		
 		case 'f': /* -f, --frequency <value> */
@@ -495,6 +497,70 @@ int main(int argc, char *argv[])
 			fullscreen = 1;
 			break;
 		
+		case _OPT_FASTFORWARD: /* --fastforward */
+			fastforward = 1;
+			break;
+		
+		case _OPT_NR: /* --nr <frames> */
+			nr_frames = atoi(optarg);
+			break;
+		
+		case _OPT_NR_MODE: /* --nr-mode <stack|recursive> */
+			if(strcmp(optarg, "stack") == 0)
+			{
+				nr_mode = TNR_STACK;
+			}
+			else if(strcmp(optarg, "recursive") == 0)
+			{
+				nr_mode = TNR_RECURSIVE;
+			}
+			else
+			{
+				fprintf(stderr, "Unrecognised noise reduction mode '%s'.\n", optarg);
+				return(-1);
+			}
+			
+			break;
+		
+		case _OPT_SCOPE: /* --scope <updates per second> */
+			scope_rate = atoi(optarg);
+			break;
+		
+		case _OPT_AFC: /* --afc */
+			afc = 1;
+			break;
+		
+		case _OPT_BENCH: /* --bench <seconds> */
+			bench = atof(optarg);
+			break;
+		
+		case _OPT_HEADLESS: /* --headless */
+			headless = 1;
+			break;
+		
+		case _OPT_SHM: /* --shm <name> */
+			free(shm_name);
+			shm_name = strdup(optarg);
+			break;
+		
+		case _OPT_BATCH: /* --batch <workers> */
+			batch.workers = atoi(optarg);
+			if(batch.workers < 1) batch.workers = sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+		
+		case _OPT_GOVERNOR: /* --governor */
+			governor = 1;
+			break;
+		
+		case _OPT_RECORD: /* --record <file> */
+			free(record);
+			record = strdup(optarg);
+			break;
+		
+		case _OPT_SCANLINE: /* --scanline */
+			scanline = 1;
+			break;
+		
 		case '?':
 			_print_usage();
 			return(0);
@@ -512,6 +578,23 @@ int main(int argc, char *argv[])
 	
 	
 	/* Configuration is complete! Lets begin ... */
+	if(batch.workers > 0)
+	{
+		/* Every remaining argument is a file or pattern to decode */
+		if(optind == argc)
+		{
+			fprintf(stderr, "No input specified.\n");
+			return(-1);
+		}
+		
+		batch.colour = colour;
+		batch.sample_rate = sample_rate;
+		batch.auto_rate = auto_rate;
+		batch.deviation = deviation;
+		
+		return(batch_run(argv + optind, argc - optind, &batch));
+	}
+	
 	if(device == NULL || strcmp(device, "file") == 0)
 	{
 		if(optind == argc)
@@ -520,7 +603,7 @@ int main(int argc, char *argv[])
 			return(-1);
 		}
 		
-		if(sdr_open_file(&sdr, argv[optind]))
+		if(sdr_open_file(&sdr, argv[optind], 0))
 		{
 			fprintf(stderr, "Error opening file '%s'.\n", argv[optind]);
 			return(-1);
@@ -528,11 +611,19 @@ int main(int argc, char *argv[])
 	}
 	else if(strcmp(device, "rtlsdr") == 0)
 	{
+		if(auto_rate)
+		{
+			fprintf(stderr, "Sample rate detection is only available for files.\n");
+			return(-1);
+		}
+		
 		if(sdr_open_rtlsdr(&sdr, 0, sample_rate, frequency, -1, error_ppm) < 0)
 		{
 			fprintf(stderr, "Error opening SDR input.\n");
 			return(-1);
 		}
+		
+		live = 1;
 	}
 	else
 	{
@@ -540,32 +631,165 @@ int main(int argc, char *argv[])
 		return(-1);
 	}
 	
-	if(_usbtv_init(&tv, sample_rate, colour) != 0)
+	/* Try each candidate standard and rate on the first block of
+	 * samples. The block is replayed into the chosen decoder */
+	if(colour < 0 || auto_rate)
+	{
+		pre = _autodetect(&sdr, &pre_len, &sample_rate, &colour, auto_rate, deviation);
+		if(!pre)
+		{
+			return(-1);
+		}
+	}
+	
+	if(bench > 0)
+	{
+		/* Time the decoder on the input, without any display */
+		r = _bench(&sdr, pre, pre_len, sample_rate, colour, deviation, bench);
+		free(pre);
+		return(r);
+	}
+	
+	if(usbtv_init(&tv, sample_rate, colour) != 0)
 	{
 		fprintf(stderr, "Error initialising decoder.\n");
 		return(-1);
 	}
 	
-	if(SDL_Init(SDL_INIT_VIDEO) < 0)
+	fprintf(stderr, "Video: %dx%d %.2f fps (full frame %dx%d)\n",
+		tv.active_width, tv.active_lines, (double) tv.frame_rate_num / tv.frame_rate_den,
+		tv.width, tv.lines
+	);
+	
+	fprintf(stderr, "Sample rate: %d\n", tv.sample_rate);
+	
+	fm_demod_init(&fm, sample_rate, deviation);
+	
+	/* Record the input, including any used for detection */
+	if(record && iqz_writer_open(&rec, record) != 0)
 	{
-		fprintf(stderr, "Error: %s\n", SDL_GetError());
+		fprintf(stderr, "Error opening the recording '%s'.\n", record);
 		return(-1);
 	}
 	
-	if(SDL_CreateWindowAndRenderer(tv.active_lines * 4 / 3, tv.active_lines, SDL_WINDOW_RESIZABLE, &window, &renderer) < 0)
+	/* Publish each frame or field for other local processes */
+	if(shm_name && shmring_create(&shm, shm_name, _SHM_SLOTS, &tv) != 0)
 	{
-		fprintf(stderr, "Error: %s\n", SDL_GetError());
+		fprintf(stderr, "Error creating the shared memory output.\n");
 		return(-1);
 	}
 	
-	SDL_SetWindowTitle(window, "Apollo TV Viewer");
-	SDL_SetWindowFullscreen(window, (fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
-	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "best"); /* nearest | linear | best */
-	SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
-	SDL_RenderSetLogicalSize(renderer, tv.active_lines * 4 / 3, tv.active_lines);
+	if(headless)
+	{
+		/* Without a display, stop cleanly on a signal so
+		 * the shared memory output is removed */
+		signal(SIGINT, _sigint_handler);
+		signal(SIGTERM, _sigint_handler);
+		
+		if(scope_rate > 0)
+		{
+			fprintf(stderr, "The spectrum overlay needs a display, ignoring --scope.\n");
+			scope_rate = 0;
+		}
+		
+		if(nr_frames > 0)
+		{
+			fprintf(stderr, "Noise reduction only applies to the display, ignoring --nr.\n");
+			nr_frames = 0;
+		}
+		
+		fastforward = 0;
+		scanline = 0;
+	}
+	else
+	{
+		if(SDL_Init(SDL_INIT_VIDEO) < 0)
+		{
+			fprintf(stderr, "Error: %s\n", SDL_GetError());
+			return(-1);
+		}
+		
+		if(SDL_CreateWindowAndRenderer(tv.active_lines * 4 / 3, tv.active_lines, SDL_WINDOW_RESIZABLE, &window, &renderer) < 0)
+		{
+			fprintf(stderr, "Error: %s\n", SDL_GetError());
+			return(-1);
+		}
+		
+		SDL_SetWindowTitle(window, "Apollo TV Viewer");
+		SDL_SetWindowFullscreen(window, (fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
+		SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "best"); /* nearest | linear | best */
+		SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
+		SDL_RenderSetLogicalSize(renderer, tv.active_lines * 4 / 3, tv.active_lines);
+		
+		/* Create the surface we'll be rendering into. Mono frames are luma
+		 * only, uploaded as the Y plane of a planar YUV texture with fixed
+		 * neutral chroma. The renderer does the expansion to RGB. SDL can't
+		 * update the Y plane alone, so each upload also sends the two
+		 * quarter size chroma planes, 1.5 bytes per pixel against 4 */
+		if(tv.colour)
+		{
+			texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, tv.active_width, tv.active_lines);
+		}
+		else
+		{
+			chroma_pitch = (tv.active_width + 1) / 2;
+			chroma = malloc(chroma_pitch * ((tv.active_lines + 1) / 2));
+			if(!chroma)
+			{
+				perror("malloc");
+				return(-1);
+			}
+			
+			memset(chroma, 128, chroma_pitch * ((tv.active_lines + 1) / 2));
+			
+			/* Full range, so luma 0-255 maps directly to black-white */
+			SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);
+			texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_IYUV, SDL_TEXTUREACCESS_STREAMING, tv.active_width, tv.active_lines);
+		}
+	}
 	
-	/* Create the surface we'll be rendering into */
-	texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, tv.active_width, tv.active_lines);
+	if(scanline)
+	{
+		/* Lines are shown as they are decoded, at the display's refresh rate */
+		if(SDL_GetWindowDisplayMode(window, &mode) != 0 || mode.refresh_rate <= 0)
+		{
+			mode.refresh_rate = 60;
+		}
+		
+		refresh_ms = 1000 / mode.refresh_rate;
+		
+		if(nr_frames > 0)
+		{
+			fprintf(stderr, "Noise reduction works on whole frames, ignoring --nr.\n");
+			nr_frames = 0;
+		}
+	}
+	
+	/* Temporal noise reduction runs on its own thread */
+	if(nr_frames > 0 &&
+	   tnr_init(&tnr, tv.active_width * tv.bytes_per_pixel, tv.active_lines, nr_mode, nr_frames) != 0)
+	{
+		fprintf(stderr, "Error initialising noise reduction.\n");
+		return(-1);
+	}
+	
+	/* The spectrum overlay covers the bottom of the picture */
+	if(scope_rate > 0)
+	{
+		if(scope_init(&scope, scope_rate, tv.lines) != 0)
+		{
+			fprintf(stderr, "Error initialising the spectrum overlay.\n");
+			return(-1);
+		}
+		
+		overlay = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCOPE_WIDTH, SCOPE_HEIGHT);
+		SDL_SetTextureBlendMode(overlay, SDL_BLENDMODE_BLEND);
+		
+		overlay_rect.w = tv.active_lines * 4 / 3;
+		overlay_rect.h = overlay_rect.w * SCOPE_HEIGHT / SCOPE_WIDTH / 2;
+		overlay_rect.x = 0;
+		overlay_rect.y = tv.active_lines - overlay_rect.h;
+	}
 	
 	/* Calculate the ticks per frame (or field for the colour mode) */
 	tpf = 1000 * tv.frame_rate_den / tv.frame_rate_num;
@@ -573,44 +797,236 @@ int main(int argc, char *argv[])
 	
 	timer = SDL_GetTicks() + tpf;
 	
+	for(r = 0; r < _LAT_STAGES; r++)
+	{
+		latency_init(&lat[r], _lat_names[r]);
+	}
+	
+	/* In fast-forward mode nothing is rasterised until a frame is due */
+	tv.skip = fastforward;
+	
+	/* The governor is updated every frame, or colour field */
+	governor_init(&gov, 1000000000LL * tv.frame_rate_den / tv.frame_rate_num / (tv.colour ? 2 : 1));
+	gov_last = sdr_clock();
+	
+	/* SIGUSR1 prints the latency report, as the L key does */
+	signal(SIGUSR1, _sigusr1_handler);
+	
 	/* Enter the main loop */
 	done = 0;
 	fullscreen = 0;
 	c = optind;
 	
-	while(!done)
+	while(!done && !_quit)
 	{
-		while((r = _usbtv_read(&tv)) == 2)
+		while((r = usbtv_read(&tv)) == 2)
 		{
-			int i;
+			t = &trace[trace_pos % _TRACE_LEN];
 			
-			r = sdr_read(&sdr, buf, 1024);
-			if(r <= 0) break;
+			if(pre_pos < pre_len)
+			{
+				r = pre_len - pre_pos;
+				if(r > 1024) r = 1024;
+				
+				memcpy(buf, pre + pre_pos * 2, r * 2 * sizeof(int16_t));
+				pre_pos += r;
+				
+				/* Detection samples are timed from their replay */
+				t->read = t->arrive = sdr_clock();
+			}
+			else
+			{
+				now = sdr_clock();
+				
+				r = sdr_read(&sdr, buf, 1024);
+				if(r <= 0)
+				{
+					/* The end of the input, or an error */
+					eof = (r == 0);
+					r = -1;
+					break;
+				}
+				
+				if(scanline && !live && !fastforward)
+				{
+					/* Replay files in real time, so lines are
+					 * shown as they would be received */
+					if(pace == 0) pace = sdr_clock() - in_pos * 1000000000LL / sample_rate;
+					
+					due = pace + in_pos * 1000000000LL / sample_rate;
+					if(due - sdr_clock() >= 1000000)
+					{
+						SDL_Delay((due - sdr_clock()) / 1000000);
+					}
+					
+					sdr.timestamp = sdr_clock();
+				}
+				
+				t->arrive = sdr.timestamp;
+				t->read = sdr_clock();
+				
+				/* Time spent waiting for input is idle */
+				gov_idle += t->read - now;
+				
+				/* Let the decoder run on through any lost samples */
+				if(sdr.dropped > 0)
+				{
+					usbtv_gap(&tv, sdr.dropped);
+					in_pos += sdr.dropped;
+					gov_dropped += sdr.dropped;
+				}
+			}
+			
+			if(record && iqz_write(&rec, buf, r) != 0)
+			{
+				fprintf(stderr, "Error writing the recording, stopping.\n");
+				iqz_writer_close(&rec);
+				free(record);
+				record = NULL;
+			}
+			
+			if(scope_rate > 0)
+			{
+				scope_feed_iq(&scope, buf, r);
+			}
 			
 			/* Demod FM */
-			for(i = 0; i < r; i++)
+			fm_demod(&fm, buf, buf, r);
+			
+			t->sample = in_pos;
+			t->demod = sdr_clock();
+			trace_pos++;
+			in_pos += r;
+			
+			if(scope_rate > 0)
 			{
-				double d2, d = atan2(buf[i * 2], buf[i * 2 + 1]);
-				
-				d2 = fm - d;
-				if(d2 < -M_PI) d2 += M_PI * 2;
-				if(d2 >= M_PI) d2 -= M_PI * 2;
-				buf[i] = round(d2 * ((sample_rate / (2.0 * M_PI)) / deviation) * INT16_MAX);
-				fm = d;
+				scope_feed_demod(&scope, buf, r);
 			}
 			
-			_usbtv_write(&tv, buf, r);
+			usbtv_write(&tv, buf, r);
+		}
+		
+		if(r >= 0 && scope_rate > 0)
+		{
+			scope_line(&scope, &tv.info);
 		}
 		
 		if(r == 1)
+		{
+			decoded = sdr_clock();
+			usbtv_frame_info(&tv, &lf);
+		}
+		
+		if(r == 1 && afc && !tv.acquire)
+		{
+			/* Any difference from the nominal sync level is the residual
+			 * carrier offset. Correct half of it each frame or field */
+			offset = (double) (tv.sync_level - USBTV_SYNC_LEVEL) / INT16_MAX * deviation;
+			offset = fm.offset + offset / 2;
+			
+			if(offset > sample_rate / 4) offset = sample_rate / 4;
+			if(offset < -(double) sample_rate / 4) offset = -(double) sample_rate / 4;
+			
+			fm_demod_set_offset(&fm, offset);
+		}
+		
+		if(r == 1 && nr_frames > 0 && !tv.skip)
+		{
+			usbtv_frame_t f;
+			
+			/* Pass the new frame, or a single colour field, to the noise
+			 * reduction. The result is displayed on the next update */
+			usbtv_frame_info(&tv, &f);
+			tnr_push(&tnr, f.framebuffer, f.first_row, f.row_step, tv.colour ? (uint32_t) 0xFF << (f.fsc * 8) : 0xFFFFFFFF);
+		}
+		
+		if(r == 1 && shm_name && !tv.skip)
+		{
+			usbtv_frame_t f;
+			
+			usbtv_frame_info(&tv, &f);
+			shmring_publish(&shm, &f);
+		}
+		
+		if(r == 1 && headless)
+		{
+			_trace_frame(lat, trace, trace_pos, &lf, decoded, sdr_clock());
+		}
+		
+		if(r == 1 && governor && !fastforward)
+		{
+			const _trace_t *last = &trace[(trace_pos - 1) % _TRACE_LEN];
+			int level, n, p;
+			
+			/* The lag of the newest input shows how full the SDR buffers are */
+			now = sdr_clock();
+			level = governor_update(&gov, gov_dropped, last->read - last->arrive, now - gov_last - gov_idle, now - gov_last);
+			gov_dropped = 0;
+			gov_idle = 0;
+			gov_last = now;
+			
+			fm_demod_set_fast(&fm, level >= GOVERNOR_FAST_DEMOD);
+			tv.decimate = (level >= GOVERNOR_DECIMATE ? 2 : 1);
+			
+			if(level >= GOVERNOR_SKIP)
+			{
+				/* Rasterise and present every other frame. A full
+				 * colour picture needs all six fields, so these
+				 * alternate six at a time */
+				n = (tv.colour ? 6 : 1);
+				p = gov_phase;
+				gov_phase = (gov_phase + 1) % (n * 2);
+				tv.skip = (gov_phase >= n);
+				
+				if(p != n - 1)
+				{
+					/* Keep the display to time over frames not shown */
+					timer += tpf;
+					r = 0;
+				}
+			}
+			else
+			{
+				tv.skip = 0;
+				gov_phase = 0;
+			}
+		}
+		
+		if(r == 1 && fastforward)
+		{
+			/* When fast-forwarding, decode as fast as possible and
+			 * only rasterise the frames that will be displayed. A
+			 * full colour picture needs all six fields */
+			if(tv.skip)
+			{
+				if(SDL_GetTicks() >= timer)
+				{
+					tv.skip = 0;
+					pending = (tv.colour ? 6 : 1);
+				}
+				
+				r = 0;
+			}
+			else if(--pending > 0)
+			{
+				r = 0;
+			}
+			else
+			{
+				tv.skip = 1;
+			}
+		}
+		
+		if(r == 1 && !headless)
 		{
 			unsigned int t;
 			
 			/* Limit FPS */
 			t = SDL_GetTicks();
-			if(t < timer)
+			if(t < timer && !fastforward && !scanline)
 			{
 				SDL_Delay(timer - t);
+				gov_idle += (int64_t) (timer - t) * 1000000;
 				timer += tpf;
 			}
 			else
@@ -619,18 +1035,69 @@ int main(int argc, char *argv[])
 			}
 			
 			/* A frame has been decoded. Push and display the frame */
-			SDL_UpdateTexture(texture, NULL, tv.framebuffer, tv.active_width * sizeof(uint32_t));
-			SDL_RenderClear(renderer);
-			SDL_RenderCopy(renderer, texture, NULL, NULL);
-			SDL_RenderPresent(renderer);
+			frame = (nr_frames > 0 ? tnr_output(&tnr) : tv.framebuffer);
+			
+			if(scanline)
+			{
+				/* Only the rows not yet shown */
+				if((rows = usbtv_dirty(&tv, &first)) > 0)
+				{
+					_upload(texture, &tv, frame, chroma, chroma_pitch, first, rows);
+				}
+				
+				refresh = SDL_GetTicks() + refresh_ms;
+			}
+			else if(tv.colour)
+			{
+				SDL_UpdateTexture(texture, NULL, frame, tv.active_width * tv.bytes_per_pixel);
+			}
+			else
+			{
+				SDL_UpdateYUVTexture(texture, NULL, frame, tv.active_width, chroma, chroma_pitch, chroma, chroma_pitch);
+			}
+			
+			/* Only upload the overlay when it has changed */
+			if(scope_rate > 0 && scope_show && (p = scope_output(&scope)) != NULL)
+			{
+				SDL_UpdateTexture(overlay, NULL, p, SCOPE_WIDTH * sizeof(uint32_t));
+			}
+			
+			_render(renderer, texture, (scope_rate > 0 && scope_show ? overlay : NULL), &overlay_rect);
+			
+			now = sdr_clock();
+			_trace_frame(lat, trace, trace_pos, &lf, decoded, now);
+			_trace_line(lat, trace, trace_pos, lf.last_sample, now);
+		}
+		else if(r == 0 && scanline && !fastforward && SDL_GetTicks() >= refresh)
+		{
+			/* Show the lines decoded so far, once per display refresh */
+			if((rows = usbtv_dirty(&tv, &first)) > 0)
+			{
+				_upload(texture, &tv, tv.framebuffer, chroma, chroma_pitch, first, rows);
+				_render(renderer, texture, (scope_rate > 0 && scope_show ? overlay : NULL), &overlay_rect);
+				_trace_line(lat, trace, trace_pos, tv.info.sample + tv.info.width - 1, sdr_clock());
+			}
+			
+			refresh = SDL_GetTicks() + refresh_ms;
+		}
+		else if(r < 0 && eof && !headless)
+		{
+			/* Keep the last frame on screen until the window is closed */
+			SDL_Delay(10);
 		}
 		else if(r < 0)
 		{
-			/* There's been an error. Break out */
+			/* The input has ended or there's been an error. Break out */
 			done = 1;
 		}
 		
-		while(SDL_PollEvent(&event))
+		if(_report)
+		{
+			_report = 0;
+			latency_report(stderr, lat, _LAT_STAGES);
+		}
+		
+		while(!headless && SDL_PollEvent(&event))
 		{
 			switch(event.type)
 			{
@@ -646,6 +1113,22 @@ int main(int argc, char *argv[])
 					fullscreen = !fullscreen;
 					SDL_SetWindowFullscreen(window, (fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : 0));
 				}
+				else if(event.key.keysym.sym == SDLK_TAB)
+				{
+					fastforward = !fastforward;
+					tv.skip = fastforward;
+					pending = 0;
+					timer = SDL_GetTicks() + tpf;
+					pace = 0;
+				}
+				else if(event.key.keysym.sym == SDLK_s)
+				{
+					scope_show = !scope_show;
+				}
+				else if(event.key.keysym.sym == SDLK_l)
+				{
+					latency_report(stderr, lat, _LAT_STAGES);
+				}
 				break;
 			
 			case SDL_QUIT:
@@ -655,8 +1138,57 @@ int main(int argc, char *argv[])
 		}
 	}
 	
-	SDL_Quit();
-	_usbtv_free(&tv);
+	if(!headless)
+	{
+		SDL_Quit();
+	}
+	
+	if(shm_name)
+	{
+		shmring_close(&shm);
+		free(shm_name);
+	}
+	
+	if(nr_frames > 0)
+	{
+		tnr_free(&tnr);
+	}
+	
+	if(scope_rate > 0)
+	{
+		scope_free(&scope);
+	}
+	
+	if(record)
+	{
+		if(iqz_writer_close(&rec) == 0)
+		{
+			fprintf(stderr, "Recorded %lld samples, %.1f%% of the raw size\n",
+				(long long) rec.samples, rec.samples > 0 ? 100.0 * rec.bytes / (rec.samples * 2) : 0
+			);
+		}
+		
+		free(record);
+	}
+	
+	if(lat[0].count > 0)
+	{
+		latency_report(stderr, lat, _LAT_STAGES);
+	}
+	
+	if(tv.stat_dropped > 0)
+	{
+		fprintf(stderr, "Dropped input skipped by reacquiring: %lld samples\n", (long long) tv.stat_dropped);
+	}
+	
+	if(afc)
+	{
+		fprintf(stderr, "AFC offset: %+.1f kHz\n", fm.offset / 1000);
+	}
+	
+	usbtv_free(&tv);
+	free(chroma);
+	free(pre);
 	
 	printf("\nDone!\n");
 	
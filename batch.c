@@ -0,0 +1,360 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+/* Batch decoding. Workers take the next file from a shared index into
+ * the list, so no file waits behind a slow one on another worker */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <glob.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "sdr.h"
+#include "usbtv.h"
+#include "fm.h"
+#include "detect.h"
+#include "batch.h"
+
+typedef struct {
+	
+	const char *name;
+	
+	/* Results */
+	int ok;
+	int colour;
+	uint32_t sample_rate;
+	int64_t samples;
+	int frames;
+	double quality;
+	
+} _file_t;
+
+typedef struct {
+	
+	const batch_opts_t *opts;
+	_file_t *files;
+	int nfiles;
+	int next;
+	
+	/* Decode threads for each compressed input */
+	int threads;
+	
+} _batch_t;
+
+typedef struct {
+	
+	FILE *f;
+	uint8_t *row;
+	int frames;
+	
+} _output_t;
+
+static void _write_frame(void *user, const usbtv_frame_t *frame)
+{
+	_output_t *o = user;
+	const uint8_t *p;
+	uint32_t c;
+	int x, y;
+	
+	/* Colour frames are written once both fields are complete */
+	if(frame->field == 1) return;
+	
+	if(frame->bytes_per_pixel == 1)
+	{
+		fprintf(o->f, "P5\n%d %d\n255\n", frame->width, frame->height);
+		
+		for(y = 0; y < frame->height; y++)
+		{
+			fwrite(frame->framebuffer + y * frame->stride, 1, frame->width, o->f);
+		}
+	}
+	else
+	{
+		fprintf(o->f, "P6\n%d %d\n255\n", frame->width, frame->height);
+		
+		for(y = 0; y < frame->height; y++)
+		{
+			p = frame->framebuffer + y * frame->stride;
+			
+			for(x = 0; x < frame->width; x++)
+			{
+				memcpy(&c, p + x * 4, sizeof(uint32_t));
+				o->row[x * 3 + 0] = c >> 16;
+				o->row[x * 3 + 1] = c >> 8;
+				o->row[x * 3 + 2] = c;
+			}
+			
+			fwrite(o->row, 3, frame->width, o->f);
+		}
+	}
+	
+	o->frames++;
+}
+
+static int _decode_file(_file_t *file, const batch_opts_t *opts, int threads)
+{
+	sdr_t sdr;
+	usbtv_t tv;
+	fm_demod_t fm;
+	detect_result_t best;
+	_output_t out;
+	int16_t *pre = NULL;
+	int pre_len = 0;
+	int16_t buf[1024 * 2];
+	char *name;
+	int found;
+	int err = 0;
+	int i, r;
+	
+	file->colour = opts->colour;
+	file->sample_rate = opts->sample_rate;
+	
+	if(sdr_open_file(&sdr, file->name, threads))
+	{
+		fprintf(stderr, "Error opening file '%s'.\n", file->name);
+		return(-1);
+	}
+	
+	if(opts->colour < 0 || opts->auto_rate)
+	{
+		pre = detect_sdr(&sdr, &pre_len, &best, &found, opts->sample_rate, opts->auto_rate, opts->deviation);
+		if(!pre)
+		{
+			sdr_close(&sdr);
+			return(-1);
+		}
+		
+		if(found)
+		{
+			file->colour = best.colour;
+			file->sample_rate = best.sample_rate;
+		}
+		else if(file->colour < 0)
+		{
+			file->colour = 0;
+		}
+	}
+	
+	if(usbtv_init(&tv, file->sample_rate, file->colour) != 0)
+	{
+		fprintf(stderr, "Error initialising decoder.\n");
+		free(pre);
+		sdr_close(&sdr);
+		return(-1);
+	}
+	
+	fm_demod_init(&fm, file->sample_rate, opts->deviation);
+	
+	/* The output goes alongside the input */
+	name = malloc(strlen(file->name) + 5);
+	out.row = malloc(tv.active_width * 3);
+	out.frames = 0;
+	out.f = NULL;
+	
+	if(name && out.row)
+	{
+		sprintf(name, "%s.%s", file->name, file->colour ? "ppm" : "pgm");
+		out.f = fopen(name, "wb");
+		if(!out.f) perror(name);
+	}
+	
+	if(!out.f)
+	{
+		free(name);
+		free(out.row);
+		usbtv_free(&tv);
+		free(pre);
+		sdr_close(&sdr);
+		return(-1);
+	}
+	
+	usbtv_set_callbacks(&tv, NULL, _write_frame, &out);
+	
+	/* Replay the detection block, then the rest of the file */
+	for(i = 0; i < pre_len && err == 0; i += r)
+	{
+		r = pre_len - i;
+		if(r > 1024) r = 1024;
+		
+		memcpy(buf, pre + i * 2, r * 2 * sizeof(int16_t));
+		fm_demod(&fm, buf, buf, r);
+		if(usbtv_push(&tv, buf, r) < 0) err = -1;
+	}
+	
+	file->samples = pre_len;
+	
+	while(err == 0 && (r = sdr_read(&sdr, buf, 1024)) > 0)
+	{
+		fm_demod(&fm, buf, buf, r);
+		if(usbtv_push(&tv, buf, r) < 0) err = -1;
+		file->samples += r;
+	}
+	
+	/* A read or decoder error fails the file, with no lock quality */
+	if(err == 0 && r < 0) err = -1;
+	
+	file->frames = out.frames;
+	file->quality = usbtv_lock_quality(&tv);
+	file->ok = (err == 0);
+	
+	fclose(out.f);
+	free(name);
+	free(out.row);
+	usbtv_free(&tv);
+	free(pre);
+	sdr_close(&sdr);
+	
+	return(err);
+}
+
+static void *_batch_thread(void *arg)
+{
+	_batch_t *b = arg;
+	int i;
+	
+	while((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->nfiles)
+	{
+		if(_decode_file(&b->files[i], b->opts, b->threads) != 0)
+		{
+			fprintf(stderr, "Error decoding '%s'.\n", b->files[i].name);
+		}
+	}
+	
+	return(NULL);
+}
+
+int batch_run(char *const *files, int nfiles, const batch_opts_t *opts)
+{
+	struct timespec start, end;
+	pthread_t *threads;
+	glob_t g;
+	_batch_t b;
+	int64_t samples;
+	double elapsed, seconds;
+	int i, n, r, failed;
+	
+	/* Expand any patterns, other names are kept as they are */
+	memset(&g, 0, sizeof(g));
+	
+	for(i = 0; i < nfiles; i++)
+	{
+		r = glob(files[i], GLOB_NOCHECK | (i > 0 ? GLOB_APPEND : 0), NULL, &g);
+		if(r != 0)
+		{
+			fprintf(stderr, "Error expanding '%s'.\n", files[i]);
+			globfree(&g);
+			return(-1);
+		}
+	}
+	
+	memset(&b, 0, sizeof(b));
+	b.opts = opts;
+	b.nfiles = g.gl_pathc;
+	b.files = calloc(b.nfiles, sizeof(_file_t));
+	
+	n = (opts->workers < b.nfiles ? opts->workers : b.nfiles);
+	if(n < 1) n = 1;
+	
+	/* Share the CPUs between the workers, rather than
+	 * each compressed input taking all of them */
+	b.threads = sysconf(_SC_NPROCESSORS_ONLN) / n;
+	if(b.threads < 1) b.threads = 1;
+	
+	threads = calloc(n, sizeof(pthread_t));
+	
+	if(!b.files || !threads)
+	{
+		perror("calloc");
+		free(b.files);
+		free(threads);
+		globfree(&g);
+		return(-1);
+	}
+	
+	for(i = 0; i < b.nfiles; i++)
+	{
+		b.files[i].name = g.gl_pathv[i];
+	}
+	
+	fprintf(stderr, "Decoding %d files with %d workers...\n", b.nfiles, n);
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	for(i = 0; i < n; i++)
+	{
+		if(pthread_create(&threads[i], NULL, _batch_thread, &b) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+	}
+	
+	/* Any workers that did start finish the list */
+	n = i;
+	
+	for(i = 0; i < n; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	
+	/* Per-file summary, in the order given */
+	printf("%-40s %-6s %9s %8s %7s %8s\n", "File", "Mode", "Rate", "Seconds", "Frames", "Quality");
+	
+	samples = 0;
+	seconds = 0;
+	failed = 0;
+	
+	for(i = 0; i < b.nfiles; i++)
+	{
+		_file_t *f = &b.files[i];
+		
+		if(!f->ok)
+		{
+			printf("%-40s failed\n", f->name);
+			failed++;
+			continue;
+		}
+		
+		printf("%-40s %-6s %9u %8.1f %7d %7.1f%%\n",
+			f->name, f->colour ? "colour" : "mono", f->sample_rate,
+			(double) f->samples / f->sample_rate, f->frames, f->quality * 100
+		);
+		
+		samples += f->samples;
+		seconds += (double) f->samples / f->sample_rate;
+	}
+	
+	printf("\n%d files, %.1f seconds of signal in %.1f seconds (%.1fx real time, %.1f MS/s)\n",
+		b.nfiles - failed, seconds, elapsed,
+		elapsed > 0 ? seconds / elapsed : 0,
+		elapsed > 0 ? samples / elapsed / 1e6 : 0
+	);
+	
+	free(b.files);
+	free(threads);
+	globfree(&g);
+	
+	return(n > 0 && failed == 0 ? 0 : -1);
+}
+
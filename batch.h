@@ -0,0 +1,46 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef _BATCH_H
+#define _BATCH_H
+
+#include <stdint.h>
+
+/* Decode a list of capture files without a display, on a pool of
+ * worker threads. Each file is written as a stream of binary PGM
+ * (mono) or PPM (colour) frames to <file>.pgm or <file>.ppm */
+
+typedef struct {
+	
+	/* As the viewer options. colour < 0 or auto_rate detect the
+	 * standard for each file */
+	int colour;
+	uint32_t sample_rate;
+	int auto_rate;
+	double deviation;
+	
+	int workers;
+	
+} batch_opts_t;
+
+/* Files are decoded in any order. Arguments containing wildcards are
+ * expanded with glob(3). Returns 0 if every file decoded, or -1 */
+extern int batch_run(char *const *files, int nfiles, const batch_opts_t *opts);
+
+#endif
+
@@ -0,0 +1,192 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Automatic detection of the video standard and sample rate.
+ *
+ * Each candidate sample rate gets a thread which demodulates the
+ * block once and runs it through both a mono and a colour decoder.
+ * Rasterising is skipped, only the sync tracking matters here. The
+ * decoders are scored by usbtv_lock_quality().
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "usbtv.h"
+#include "fm.h"
+#include "detect.h"
+
+#define _BLOCK 4096
+
+/* Sample rates tried by -s auto */
+static const uint32_t _rates[] = {
+	1024000, 1536000, 1800000, 2048000, 2250000, 2400000, 2560000, 3200000
+};
+
+typedef struct {
+	
+	pthread_t thread;
+	
+	const int16_t *iq;
+	int samples;
+	double deviation;
+	
+	uint32_t sample_rate;
+	double score[2];
+	
+} _candidate_t;
+
+static void *_detect_thread(void *arg)
+{
+	_candidate_t *c = arg;
+	usbtv_t tv[2];
+	fm_demod_t fm;
+	int16_t buf[_BLOCK];
+	int i, n, m;
+	
+	c->score[0] = c->score[1] = 0;
+	
+	if(usbtv_init(&tv[0], c->sample_rate, 0) != 0)
+	{
+		return(NULL);
+	}
+	
+	if(usbtv_init(&tv[1], c->sample_rate, 1) != 0)
+	{
+		usbtv_free(&tv[0]);
+		return(NULL);
+	}
+	
+	tv[0].skip = tv[1].skip = 1;
+	
+	fm_demod_init(&fm, c->sample_rate, c->deviation);
+	
+	for(i = 0; i < c->samples; i += n)
+	{
+		n = c->samples - i;
+		if(n > _BLOCK) n = _BLOCK;
+		
+		fm_demod(&fm, buf, c->iq + i * 2, n);
+		
+		for(m = 0; m < 2; m++)
+		{
+			usbtv_push(&tv[m], buf, n);
+		}
+	}
+	
+	for(m = 0; m < 2; m++)
+	{
+		c->score[m] = usbtv_lock_quality(&tv[m]);
+		usbtv_free(&tv[m]);
+	}
+	
+	return(NULL);
+}
+
+int detect_standard(detect_result_t *best, const int16_t *iq, int samples, const uint32_t *rates, int nrates, double deviation)
+{
+	_candidate_t *c;
+	int i, m;
+	
+	c = calloc(nrates, sizeof(_candidate_t));
+	if(!c)
+	{
+		perror("calloc");
+		return(-1);
+	}
+	
+	for(i = 0; i < nrates; i++)
+	{
+		c[i].iq = iq;
+		c[i].samples = samples;
+		c[i].deviation = deviation;
+		c[i].sample_rate = rates[i];
+		
+		if(pthread_create(&c[i].thread, NULL, _detect_thread, (void *) &c[i]) != 0)
+		{
+			/* Couldn't start a thread, run it here instead */
+			_detect_thread(&c[i]);
+			c[i].thread = 0;
+		}
+	}
+	
+	memset(best, 0, sizeof(detect_result_t));
+	
+	for(i = 0; i < nrates; i++)
+	{
+		if(c[i].thread)
+		{
+			pthread_join(c[i].thread, NULL);
+		}
+		
+		for(m = 0; m < 2; m++)
+		{
+			if(c[i].score[m] > best->score)
+			{
+				best->sample_rate = c[i].sample_rate;
+				best->colour = m;
+				best->score = c[i].score[m];
+			}
+		}
+	}
+	
+	free(c);
+	
+	return(best->score > 0 ? 0 : -1);
+}
+
+int16_t *detect_sdr(sdr_t *sdr, int *len, detect_result_t *best, int *found, uint32_t sample_rate, int auto_rate, double deviation)
+{
+	int16_t *iq;
+	int samples;
+	int r;
+	
+	/* Half a second of samples, or 2^20 if the rate is unknown */
+	samples = (auto_rate ? 1 << 20 : sample_rate / 2);
+	
+	iq = malloc(samples * 2 * sizeof(int16_t));
+	if(!iq)
+	{
+		perror("malloc");
+		return(NULL);
+	}
+	
+	for(*len = 0; *len < samples; *len += r)
+	{
+		r = samples - *len;
+		if(r > 1024) r = 1024;
+		
+		r = sdr_read(sdr, iq + *len * 2, r);
+		if(r <= 0) break;
+	}
+	
+	if(auto_rate)
+	{
+		r = detect_standard(best, iq, *len, _rates, sizeof(_rates) / sizeof(uint32_t), deviation);
+	}
+	else
+	{
+		r = detect_standard(best, iq, *len, &sample_rate, 1, deviation);
+	}
+	
+	*found = (r == 0);
+	
+	return(iq);
+}
+
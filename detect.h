@@ -0,0 +1,44 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _DETECT_H
+#define _DETECT_H
+
+#include <stdint.h>
+#include "sdr.h"
+
+typedef struct {
+	
+	uint32_t sample_rate;
+	int colour;
+	double score;
+	
+} detect_result_t;
+
+/* Try each candidate sample rate in both the mono and colour modes
+ * on a block of IQ samples. Candidates run in parallel. Returns the
+ * best scoring configuration, or -1 if nothing locked at all */
+extern int detect_standard(detect_result_t *best, const int16_t *iq, int samples, const uint32_t *rates, int nrates, double deviation);
+
+/* Read a block from an input and detect the standard on it, trying
+ * the common sample rates if auto_rate is set, or only sample_rate.
+ * Returns the samples read, for replay into the decoder, or NULL on
+ * error. *found is set to 0 if nothing locked */
+extern int16_t *detect_sdr(sdr_t *sdr, int *len, detect_result_t *best, int *found, uint32_t sample_rate, int auto_rate, double deviation);
+
+#endif
+
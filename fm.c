@@ -0,0 +1,204 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Polar discriminator. The phase step between samples is the angle of
+ * x[n] * conj(x[n - 1]). Mixing the input with an NCO before the
+ * discriminator only adds a constant to that step, so the frequency
+ * correction is applied by multiplying the product with a fixed
+ * rotor, in the same pass, instead of mixing every sample.
+ *
+ * The kernel processes 4 samples at a time using the GCC vector
+ * extensions, with a polynomial atan2 accurate to well under one
+ * output step. A shorter polynomial, accurate to about one output
+ * step at typical deviations, can be selected to save time. IQ
+ * pairs are loaded as one int32 each, with I in the low half on
+ * little-endian hosts and the high half on big-endian.
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "fm.h"
+
+typedef float   _v4f   __attribute__ ((vector_size (16)));
+typedef int32_t _v4i32 __attribute__ ((vector_size (16)));
+typedef int16_t _v4i16 __attribute__ ((vector_size (8)));
+
+static inline _v4f _select(_v4i32 m, _v4f a, _v4f b)
+{
+	return((_v4f) (((_v4i32) a & m) | ((_v4i32) b & ~m)));
+}
+
+static inline __attribute__ ((always_inline)) _v4f _atan2(_v4f y, _v4f x, const int fast)
+{
+	const _v4i32 sign = (_v4i32) { } + INT32_MIN;
+	_v4f ax, ay, mn, mx, a, s, r;
+	_v4i32 m;
+	
+	ax = (_v4f) ((_v4i32) x & ~sign);
+	ay = (_v4f) ((_v4i32) y & ~sign);
+	
+	m = ay > ax;
+	mn = _select(m, ax, ay);
+	mx = _select(m, ay, ax);
+	mx = _select(mx > 0, mx, (_v4f) { } + 1.0f);
+	
+	a = mn / mx;
+	s = a * a;
+	
+	if(fast)
+	{
+		/* Abramowitz and Stegun 4.4.47, |e| <= 1e-5 on [-1, 1] */
+		r = (_v4f) { } + 0.0208351f;
+		r = r * s - 0.0851330f;
+		r = r * s + 0.1801410f;
+		r = r * s - 0.3302995f;
+		r = r * s + 0.9998660f;
+	}
+	else
+	{
+		/* Abramowitz and Stegun 4.4.49, |e| <= 2e-8 on [-1, 1] */
+		r = (_v4f) { } - 0.0040540580f;
+		r = r * s + 0.0218612288f;
+		r = r * s - 0.0559098861f;
+		r = r * s + 0.0964200441f;
+		r = r * s - 0.1390853351f;
+		r = r * s + 0.1994653599f;
+		r = r * s - 0.3332985605f;
+		r = r * s + 0.9999993329f;
+	}
+	
+	r *= a;
+	
+	/* Unfold the octant, then the quadrant */
+	r = _select(m, (float) M_PI_2 - r, r);
+	r = _select(x < 0, (float) M_PI - r, r);
+	r = (_v4f) ((_v4i32) r | ((_v4i32) y & sign));
+	
+	return(r);
+}
+
+void fm_demod_init(fm_demod_t *fm, uint32_t sample_rate, double deviation)
+{
+	fm->sample_rate = sample_rate;
+	fm->scale = ((sample_rate / (2.0 * M_PI)) / deviation) * INT16_MAX;
+	fm->prev_i = 0;
+	fm->prev_q = 0;
+	fm->fast = 0;
+	
+	fm_demod_set_offset(fm, 0);
+}
+
+void fm_demod_set_offset(fm_demod_t *fm, double offset)
+{
+	double a = 2.0 * M_PI * offset / fm->sample_rate;
+	
+	fm->offset = offset;
+	fm->rot_re = cos(a);
+	fm->rot_im = sin(a);
+}
+
+void fm_demod_set_fast(fm_demod_t *fm, int fast)
+{
+	fm->fast = fast;
+}
+
+static inline __attribute__ ((always_inline)) void _demod(fm_demod_t *fm, int16_t *out, const int16_t *iq, int samples, const int fast)
+{
+	const _v4i32 shift = { 3, 4, 5, 6 };
+	const _v4i32 sign = (_v4i32) { } + INT32_MIN;
+	const float scale = -fm->scale;
+	_v4i32 w;
+	_v4i16 o;
+	_v4f ci, cq, pi, pq, li, lq, re, im, t, d;
+	int i;
+	
+	/* The previous sample is carried in the last lane. The phase is
+	 * measured as atan2(I, Q), so Q is the real part and I imaginary */
+	li = (_v4f) { } + fm->prev_i;
+	lq = (_v4f) { } + fm->prev_q;
+	
+	for(i = 0; i + 4 <= samples; i += 4)
+	{
+		memcpy(&w, iq + i * 2, sizeof(w));
+		
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		ci = __builtin_convertvector(w >> 16, _v4f);
+		cq = __builtin_convertvector((w << 16) >> 16, _v4f);
+#else
+		ci = __builtin_convertvector((w << 16) >> 16, _v4f);
+		cq = __builtin_convertvector(w >> 16, _v4f);
+#endif
+		
+		pi = __builtin_shuffle(li, ci, shift);
+		pq = __builtin_shuffle(lq, cq, shift);
+		li = ci;
+		lq = cq;
+		
+		/* x[n] * conj(x[n - 1]), then the NCO rotor */
+		re = cq * pq + ci * pi;
+		im = ci * pq - cq * pi;
+		t = re * fm->rot_re - im * fm->rot_im;
+		im = re * fm->rot_im + im * fm->rot_re;
+		
+		d = _atan2(im, t, fast) * scale;
+		d = _select(d > INT16_MAX, (_v4f) { } + INT16_MAX, d);
+		d = _select(d < -INT16_MAX, (_v4f) { } - INT16_MAX, d);
+		
+		/* Round half away from zero */
+		d += (_v4f) ((_v4i32) ((_v4f) { } + 0.5f) | ((_v4i32) d & sign));
+		o = __builtin_convertvector(__builtin_convertvector(d, _v4i32), _v4i16);
+		
+		/* Safe in place, as this only overwrites samples already read */
+		memcpy(out + i, &o, sizeof(o));
+	}
+	
+	fm->prev_i = li[3];
+	fm->prev_q = lq[3];
+	
+	for(; i < samples; i++)
+	{
+		float si = iq[i * 2], sq = iq[i * 2 + 1];
+		float r, m;
+		
+		re = (_v4f) { } + (sq * fm->prev_q + si * fm->prev_i);
+		im = (_v4f) { } + (si * fm->prev_q - sq * fm->prev_i);
+		t = re * fm->rot_re - im * fm->rot_im;
+		im = re * fm->rot_im + im * fm->rot_re;
+		
+		m = _atan2(im, t, fast)[0] * scale;
+		r = (m > INT16_MAX ? INT16_MAX : (m < -INT16_MAX ? -INT16_MAX : m));
+		out[i] = lroundf(r);
+		
+		fm->prev_i = si;
+		fm->prev_q = sq;
+	}
+}
+
+void fm_demod(fm_demod_t *fm, int16_t *out, const int16_t *iq, int samples)
+{
+	/* Each polynomial gets its own copy of the loop */
+	if(fm->fast)
+	{
+		_demod(fm, out, iq, samples, 1);
+	}
+	else
+	{
+		_demod(fm, out, iq, samples, 0);
+	}
+}
+
@@ -0,0 +1,59 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _FM_H
+#define _FM_H
+
+#include <stdint.h>
+
+/* FM demodulator, part of libapollotv. Converts interleaved
+ * int16_t IQ samples into the baseband expected by usbtv_t */
+
+typedef struct {
+	
+	uint32_t sample_rate;
+	double scale;
+	
+	/* The last input sample */
+	float prev_i;
+	float prev_q;
+	
+	/* Frequency correction */
+	double offset;
+	float rot_re;
+	float rot_im;
+	
+	/* Use the cheaper, less accurate atan2 */
+	int fast;
+	
+} fm_demod_t;
+
+extern void fm_demod_init(fm_demod_t *fm, uint32_t sample_rate, double deviation);
+
+/* Correct for a carrier offset in Hz, as seen in I + jQ. The output
+ * is shifted by -offset / deviation * INT16_MAX at no extra cost */
+extern void fm_demod_set_offset(fm_demod_t *fm, double offset);
+
+/* Trade accuracy for speed. The fast phase detector has an error of
+ * up to 1e-5 radians, against 2e-8 normally. Off by default */
+extern void fm_demod_set_fast(fm_demod_t *fm, int fast);
+
+/* Demodulate samples IQ pairs from iq into out. out may be the same buffer as iq */
+extern void fm_demod(fm_demod_t *fm, int16_t *out, const int16_t *iq, int samples);
+
+#endif
+
@@ -0,0 +1,104 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "governor.h"
+
+/* Frames to wait after a change before stepping down again, so
+ * the effect of the last step can be seen */
+#define _SETTLE 4
+
+/* Hold times before stepping up, in ns */
+#define _HOLD_MIN 2000000000LL
+#define _HOLD_MAX 30000000000LL
+
+static const char *_names[GOVERNOR_LEVELS] = {
+	"full", "skip frames", "fast demod", "decimate",
+};
+
+static void _change(governor_t *g, int level, const char *reason, int64_t dropped, int64_t lag)
+{
+	fprintf(stderr, "Governor: %s -> %s (%s, dropped %lld, lag %.1f ms, load %.0f%%)\n",
+		_names[g->level], _names[level], reason,
+		(long long) dropped, lag / 1e6, g->load * 100
+	);
+	
+	g->raised = (level < g->level);
+	g->level = level;
+	g->since = 0;
+	g->calm = 0;
+}
+
+void governor_init(governor_t *g, int64_t period)
+{
+	g->level = GOVERNOR_FULL;
+	g->period = period;
+	g->load = 0;
+	g->since = 0;
+	g->calm = 0;
+	g->raised = 0;
+	g->hold = _HOLD_MIN / period;
+}
+
+int governor_update(governor_t *g, int64_t dropped, int64_t lag, int64_t busy, int64_t elapsed)
+{
+	const char *reason = NULL;
+	
+	if(elapsed > 0)
+	{
+		g->load += ((double) busy / elapsed - g->load) / 4;
+	}
+	
+	g->since++;
+	
+	if(dropped > 0) reason = "input dropped";
+	else if(lag > g->period * 2) reason = "input backlog";
+	else if(g->load > 0.9) reason = "overloaded";
+	
+	if(reason)
+	{
+		g->calm = 0;
+		
+		if(g->level + 1 < GOVERNOR_LEVELS && g->since >= _SETTLE)
+		{
+			/* Stepping back down soon after stepping up means
+			 * the headroom wasn't real, wait longer next time */
+			if(g->raised && g->since < g->hold)
+			{
+				g->hold *= 2;
+				if(g->hold > _HOLD_MAX / g->period) g->hold = _HOLD_MAX / g->period;
+			}
+			
+			_change(g, g->level + 1, reason, dropped, lag);
+		}
+	}
+	else if(g->load < 0.7 && lag < g->period)
+	{
+		if(++g->calm >= g->hold && g->level > GOVERNOR_FULL)
+		{
+			_change(g, g->level - 1, "headroom", dropped, lag);
+		}
+	}
+	else
+	{
+		g->calm = 0;
+	}
+	
+	return(g->level);
+}
+
@@ -0,0 +1,70 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _GOVERNOR_H
+#define _GOVERNOR_H
+
+#include <stdint.h>
+
+/* Quality governor. When the decoder can't keep up with live input,
+ * quality is reduced one step at a time rather than letting the SDR
+ * drop samples at random, and restored once there is headroom again.
+ *
+ * It is updated once per frame (or colour field) with the samples
+ * dropped, how long the newest input waited in the SDR buffers and the
+ * time spent working since the last update. Any drops, a backlog of
+ * more than two frames or a load over 90% steps down. A load under
+ * 70% with no backlog for the hold time steps back up. Stepping down
+ * soon after stepping up doubles the hold time, up to a limit, so a
+ * marginal machine settles rather than oscillating. */
+
+enum {
+	GOVERNOR_FULL,          /* Full quality */
+	GOVERNOR_SKIP,          /* Rasterise and present only every other frame */
+	GOVERNOR_FAST_DEMOD,    /* And the cheaper FM demodulator */
+	GOVERNOR_DECIMATE,      /* And half horizontal resolution */
+	GOVERNOR_LEVELS,
+};
+
+typedef struct {
+	
+	int level;
+	int64_t period;         /* Frame or field period in ns */
+	
+	/* Smoothed fraction of the time spent working */
+	double load;
+	
+	/* Frames since the last change, frames without pressure,
+	 * and how many of those are needed to step up */
+	int since;
+	int calm;
+	int hold;
+	
+	/* The last change was a step up */
+	int raised;
+	
+} governor_t;
+
+extern void governor_init(governor_t *g, int64_t period);
+
+/* Update with the samples dropped, the input lag and the busy and
+ * elapsed time since the last update, all times in nanoseconds.
+ * Returns the new level. Changes are logged to stderr */
+extern int governor_update(governor_t *g, int64_t dropped, int64_t lag, int64_t busy, int64_t elapsed);
+
+#endif
+
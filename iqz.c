@@ -0,0 +1,495 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "iqz.h"
+
+/* Quotients from here are escaped */
+#define _ESCAPE 16
+
+typedef struct {
+	uint8_t *out;
+	int pos;
+	uint64_t acc;
+	int n;
+} _bitw_t;
+
+static inline void _put(_bitw_t *w, uint32_t v, int bits)
+{
+	w->acc = (w->acc << bits) | v;
+	w->n += bits;
+	
+	while(w->n >= 8)
+	{
+		w->n -= 8;
+		w->out[w->pos++] = w->acc >> w->n;
+	}
+}
+
+static void _put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t _get32(const uint8_t *p)
+{
+	return(p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24);
+}
+
+static int _write_header(FILE *f, const iqz_header_t *h)
+{
+	uint8_t d[IQZ_HEADER_LEN];
+	
+	_put32(d + 0, h->magic);
+	_put32(d + 4, h->version);
+	_put32(d + 8, h->block);
+	
+	return(fwrite(d, sizeof(d), 1, f) == 1 ? 0 : -1);
+}
+
+int iqz_read_header(FILE *f, iqz_header_t *h)
+{
+	uint8_t d[IQZ_HEADER_LEN];
+	
+	if(fread(d, sizeof(d), 1, f) != 1) return(-1);
+	
+	h->magic = _get32(d + 0);
+	h->version = _get32(d + 4);
+	h->block = _get32(d + 8);
+	
+	return(0);
+}
+
+static int _write_block(FILE *f, const iqz_block_t *b)
+{
+	uint8_t d[IQZ_BLOCK_LEN];
+	
+	_put32(d + 0, b->samples);
+	_put32(d + 4, b->bytes);
+	d[8] = b->mode[0];
+	d[9] = b->mode[1];
+	d[10] = b->reserved[0];
+	d[11] = b->reserved[1];
+	
+	return(fwrite(d, sizeof(d), 1, f) == 1 ? 0 : -1);
+}
+
+int iqz_read_block(FILE *f, iqz_block_t *b)
+{
+	uint8_t d[IQZ_BLOCK_LEN];
+	
+	if(fread(d, sizeof(d), 1, f) != 1) return(-1);
+	
+	b->samples = _get32(d + 0);
+	b->bytes = _get32(d + 4);
+	b->mode[0] = d[8];
+	b->mode[1] = d[9];
+	b->reserved[0] = d[10];
+	b->reserved[1] = d[11];
+	
+	return(0);
+}
+
+static inline uint8_t _zigzag(int r)
+{
+	r = (int8_t) r;
+	return(r < 0 ? -r * 2 - 1 : r * 2);
+}
+
+static inline int _unzigzag(unsigned int u)
+{
+	return(u & 1 ? -(int) (u >> 1) - 1 : (int) (u >> 1));
+}
+
+static inline int _predict(int order, int x1, int x2)
+{
+	return(order == 0 ? 128 : (order == 1 ? x1 : x1 * 2 - x2));
+}
+
+static int _cost(const uint32_t *hist, int k)
+{
+	int u, q, bits = 0;
+	
+	for(u = 0; u < 256; u++)
+	{
+		q = u >> k;
+		bits += hist[u] * (q < _ESCAPE ? q + 1 + k : _ESCAPE + 8);
+	}
+	
+	return(bits);
+}
+
+/* Pick the predictor order and k for the shortest coding of one channel */
+static uint8_t _choose(const uint8_t *iq, int samples, int *bits)
+{
+	uint32_t hist[3][256];
+	int order, k, c, x1, x2, i;
+	uint8_t mode = 0;
+	
+	memset(hist, 0, sizeof(hist));
+	
+	for(order = 0; order < 3; order++)
+	{
+		x1 = x2 = 128;
+		
+		for(i = 0; i < samples; i++)
+		{
+			hist[order][_zigzag(iq[i * 2] - _predict(order, x1, x2))]++;
+			x2 = x1;
+			x1 = iq[i * 2];
+		}
+	}
+	
+	*bits = -1;
+	
+	for(order = 0; order < 3; order++)
+	{
+		for(k = 0; k < 8; k++)
+		{
+			c = _cost(hist[order], k);
+			if(*bits < 0 || c < *bits)
+			{
+				*bits = c;
+				mode = order << 4 | k;
+			}
+		}
+	}
+	
+	return(mode);
+}
+
+static void _encode_channel(_bitw_t *w, const uint8_t *iq, int samples, uint8_t mode)
+{
+	const int order = mode >> 4;
+	const int k = mode & 0x0F;
+	int x1 = 128, x2 = 128;
+	int i, u, q;
+	
+	for(i = 0; i < samples; i++)
+	{
+		u = _zigzag(iq[i * 2] - _predict(order, x1, x2));
+		q = u >> k;
+		
+		if(q < _ESCAPE)
+		{
+			/* q ones and a zero, then the low k bits */
+			_put(w, (1 << (q + 1)) - 2, q + 1);
+			_put(w, u & ((1 << k) - 1), k);
+		}
+		else
+		{
+			_put(w, (1 << _ESCAPE) - 1, _ESCAPE);
+			_put(w, u, 8);
+		}
+		
+		x2 = x1;
+		x1 = iq[i * 2];
+	}
+}
+
+int iqz_encode(iqz_block_t *b, uint8_t *out, const uint8_t *iq, int samples)
+{
+	_bitw_t w = { .out = out };
+	int bits[2];
+	
+	b->samples = samples;
+	b->mode[0] = _choose(iq, samples, &bits[0]);
+	b->mode[1] = _choose(iq + 1, samples, &bits[1]);
+	b->reserved[0] = 0;
+	b->reserved[1] = 0;
+	
+	if((bits[0] + bits[1] + 7) / 8 >= samples * 2)
+	{
+		/* Noise, or something the predictors don't suit */
+		b->mode[0] = b->mode[1] = IQZ_RAW;
+		b->bytes = samples * 2;
+		memcpy(out, iq, b->bytes);
+		
+		return(b->bytes);
+	}
+	
+	/* Each channel is padded out to a whole byte */
+	_encode_channel(&w, iq, samples, b->mode[0]);
+	if(w.n > 0) _put(&w, 0, 8 - w.n);
+	
+	_encode_channel(&w, iq + 1, samples, b->mode[1]);
+	if(w.n > 0) _put(&w, 0, 8 - w.n);
+	
+	b->bytes = w.pos;
+	
+	return(b->bytes);
+}
+
+/* Decode one channel from in[*pos], advancing *pos to the byte after it */
+static int _decode_channel(const uint8_t *in, int len, int *pos, uint8_t *iq, int samples, uint8_t mode)
+{
+	const int order = mode >> 4;
+	const int k = mode & 0x0F;
+	int64_t used = 0;
+	uint64_t acc = 0, t;
+	int n = 0;
+	int p = *pos;
+	int x, x1 = 128, x2 = 128;
+	int i, q, u;
+	
+	if(order > 2 || k > 7) return(-1);
+	
+	for(i = 0; i < samples; i++)
+	{
+		/* Keep at least one whole value in the accumulator. Bits
+		 * past the end read as zero, and are caught below */
+		while(n <= 56)
+		{
+			acc |= (uint64_t) (p < len ? in[p] : 0) << (56 - n);
+			p++;
+			n += 8;
+		}
+		
+		t = ~acc;
+		
+		if((t >> (64 - _ESCAPE)) == 0)
+		{
+			u = (acc >> (64 - _ESCAPE - 8)) & 0xFF;
+			q = _ESCAPE + 8;
+		}
+		else
+		{
+			q = __builtin_clzll(t);
+			u = (q << k) | (int) ((acc << (q + 1)) >> (63 - k) >> 1);
+			q += 1 + k;
+		}
+		
+		acc <<= q;
+		n -= q;
+		used += q;
+		
+		x = (uint8_t) (_predict(order, x1, x2) + _unzigzag(u));
+		iq[i * 2] = x;
+		x2 = x1;
+		x1 = x;
+	}
+	
+	*pos += (used + 7) / 8;
+	
+	return(*pos <= len ? 0 : -1);
+}
+
+int iqz_decode(const iqz_block_t *b, const uint8_t *in, uint8_t *iq)
+{
+	int pos = 0;
+	
+	if(b->mode[0] == IQZ_RAW || b->mode[1] == IQZ_RAW)
+	{
+		if(b->bytes != b->samples * 2) return(-1);
+		memcpy(iq, in, b->bytes);
+		
+		return(0);
+	}
+	
+	if(_decode_channel(in, b->bytes, &pos, iq, b->samples, b->mode[0]) != 0 ||
+	   _decode_channel(in, b->bytes, &pos, iq + 1, b->samples, b->mode[1]) != 0)
+	{
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static void *_writer_thread(void *arg)
+{
+	iqz_writer_t *w = arg;
+	iqz_block_t b;
+	int i, error;
+	
+	pthread_mutex_lock(&w->lock);
+	
+	for(;;)
+	{
+		while(!w->pending && !w->quit)
+		{
+			pthread_cond_wait(&w->cond, &w->lock);
+		}
+		
+		if(!w->pending) break;
+		
+		/* The caller fills the other buffer meanwhile */
+		i = !w->fill;
+		pthread_mutex_unlock(&w->lock);
+		
+		iqz_encode(&b, w->out, w->iq[i], w->len[i]);
+		
+		error = 0;
+		if(_write_block(w->f, &b) != 0 ||
+		   fwrite(w->out, 1, b.bytes, w->f) != b.bytes)
+		{
+			perror("fwrite");
+			error = 1;
+		}
+		
+		pthread_mutex_lock(&w->lock);
+		w->error |= error;
+		w->samples += b.samples;
+		w->bytes += IQZ_BLOCK_LEN + b.bytes;
+		w->pending = 0;
+		pthread_cond_broadcast(&w->cond);
+	}
+	
+	pthread_mutex_unlock(&w->lock);
+	
+	return(NULL);
+}
+
+int iqz_writer_open(iqz_writer_t *w, const char *name)
+{
+	iqz_header_t h = { IQZ_MAGIC, IQZ_VERSION, IQZ_BLOCK };
+	
+	memset(w, 0, sizeof(iqz_writer_t));
+	
+	w->iq[0] = malloc(IQZ_BLOCK * 2);
+	w->iq[1] = malloc(IQZ_BLOCK * 2);
+	w->out = malloc(IQZ_MAX_BYTES(IQZ_BLOCK));
+	if(!w->iq[0] || !w->iq[1] || !w->out)
+	{
+		perror("malloc");
+		free(w->iq[0]);
+		free(w->iq[1]);
+		free(w->out);
+		return(-1);
+	}
+	
+	w->f = fopen(name, "wb");
+	if(!w->f)
+	{
+		perror("fopen");
+		free(w->iq[0]);
+		free(w->iq[1]);
+		free(w->out);
+		return(-1);
+	}
+	
+	if(_write_header(w->f, &h) != 0)
+	{
+		perror("fwrite");
+		w->error = 1;
+	}
+	
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	
+	if(pthread_create(&w->thread, NULL, _writer_thread, w) != 0)
+	{
+		perror("pthread_create");
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->cond);
+		fclose(w->f);
+		free(w->iq[0]);
+		free(w->iq[1]);
+		free(w->out);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* Hand the filled block to the writer thread */
+static void _flush(iqz_writer_t *w)
+{
+	pthread_mutex_lock(&w->lock);
+	
+	while(w->pending)
+	{
+		pthread_cond_wait(&w->cond, &w->lock);
+	}
+	
+	w->pending = 1;
+	w->fill = !w->fill;
+	w->len[w->fill] = 0;
+	pthread_cond_broadcast(&w->cond);
+	
+	pthread_mutex_unlock(&w->lock);
+}
+
+int iqz_write(iqz_writer_t *w, const int16_t *iq, int samples)
+{
+	uint8_t *dst;
+	int i, n, error;
+	
+	while(samples > 0)
+	{
+		n = IQZ_BLOCK - w->len[w->fill];
+		if(n > samples) n = samples;
+		
+		dst = w->iq[w->fill] + w->len[w->fill] * 2;
+		
+		for(i = 0; i < n * 2; i++)
+		{
+			dst[i] = iq[i] - INT8_MIN;
+		}
+		
+		w->len[w->fill] += n;
+		iq += n * 2;
+		samples -= n;
+		
+		if(w->len[w->fill] == IQZ_BLOCK)
+		{
+			_flush(w);
+		}
+	}
+	
+	pthread_mutex_lock(&w->lock);
+	error = w->error;
+	pthread_mutex_unlock(&w->lock);
+	
+	return(error ? -1 : 0);
+}
+
+int iqz_writer_close(iqz_writer_t *w)
+{
+	if(w->len[w->fill] > 0)
+	{
+		_flush(w);
+	}
+	
+	pthread_mutex_lock(&w->lock);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+	
+	pthread_join(w->thread, NULL);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->cond);
+	
+	if(fclose(w->f) != 0)
+	{
+		perror("fclose");
+		w->error = 1;
+	}
+	
+	free(w->iq[0]);
+	free(w->iq[1]);
+	free(w->out);
+	
+	return(w->error ? -1 : 0);
+}
+
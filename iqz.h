@@ -0,0 +1,120 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _IQZ_H
+#define _IQZ_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/* Compressed IQ captures. The file starts with a header, followed by
+ * independently coded blocks so they can be decoded in parallel. Each
+ * block is a block header and its coded payload.
+ *
+ * Samples are 8-bit unsigned IQ pairs, as from the rtlsdr. I and Q are
+ * coded separately, the I values of the block then the Q values. Each
+ * value is predicted from the previous ones, with the order of the
+ * predictor chosen per block: 0 (the midpoint, 128), 1 (the last value)
+ * or 2 (a linear extrapolation of the last two). The residual, modulo
+ * 256, is zigzag mapped and Rice coded with the parameter k that gives
+ * the shortest block. A quotient of 16 or more is an escape followed by
+ * the 8-bit value. Bits are packed MSB first. A block which doesn't
+ * compress is stored raw, interleaved as the input.
+ *
+ * The headers are stored as their fields in order, with no padding.
+ * The header is IQZ_HEADER_LEN bytes and a block header IQZ_BLOCK_LEN.
+ * The 32-bit fields are little-endian.
+*/
+
+#define IQZ_MAGIC   0x5A514941 /* "AIQZ" */
+#define IQZ_VERSION 1
+
+/* Samples per block written by the recorder, and the
+ * most accepted from a file */
+#define IQZ_BLOCK     65536
+#define IQZ_BLOCK_MAX 262144
+
+/* Channel mode of a raw block */
+#define IQZ_RAW 0xFF
+
+#define IQZ_HEADER_LEN 12
+#define IQZ_BLOCK_LEN  12
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block;         /* The most samples in any block */
+} iqz_header_t;
+
+typedef struct {
+	uint32_t samples;
+	uint32_t bytes;         /* Length of the payload */
+	uint8_t mode[2];        /* Per channel, order << 4 | k, or IQZ_RAW */
+	uint8_t reserved[2];
+} iqz_block_t;
+
+/* The largest payload of a block of samples */
+#define IQZ_MAX_BYTES(samples) ((samples) * 2 * 3 + 8)
+
+/* Read a header or block header. Returns 0, or -1 at the end of the file */
+extern int iqz_read_header(FILE *f, iqz_header_t *h);
+extern int iqz_read_block(FILE *f, iqz_block_t *b);
+
+/* Code samples IQ pairs into out, which must hold IQZ_MAX_BYTES(samples).
+ * Fills in the block header and returns the payload length */
+extern int iqz_encode(iqz_block_t *b, uint8_t *out, const uint8_t *iq, int samples);
+
+/* Decode a block's payload into b->samples IQ pairs. Returns 0
+ * on success or -1 if the payload is corrupt */
+extern int iqz_decode(const iqz_block_t *b, const uint8_t *in, uint8_t *iq);
+
+/* Recorder. Samples are collected into blocks and coded and written
+ * by a background thread, so the caller only waits if it falls a
+ * whole block behind */
+typedef struct {
+	
+	FILE *f;
+	
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int quit;
+	
+	/* The block being filled, and the one waiting to be written */
+	uint8_t *iq[2];
+	int len[2];
+	int fill;
+	int pending;
+	
+	uint8_t *out;
+	int64_t samples;
+	int64_t bytes;
+	int error;
+	
+} iqz_writer_t;
+
+extern int iqz_writer_open(iqz_writer_t *w, const char *name);
+
+/* Record samples IQ pairs, in the range -128 to 127 as returned by sdr_read() */
+extern int iqz_write(iqz_writer_t *w, const int16_t *iq, int samples);
+
+/* Write any partial block and close the file. Returns 0 if every block was written */
+extern int iqz_writer_close(iqz_writer_t *w);
+
+#endif
+
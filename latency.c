@@ -0,0 +1,94 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "latency.h"
+
+/* Bin b covers up to 1µs * 2^(b / 8) */
+static int _bin(int64_t ns)
+{
+	int b;
+	
+	if(ns <= 1000) return(0);
+	
+	b = ceil(log2(ns / 1000.0) * 8);
+	
+	return(b < LATENCY_BINS ? b : LATENCY_BINS - 1);
+}
+
+static int64_t _bin_limit(int b)
+{
+	return(llround(1000.0 * pow(2, b / 8.0)));
+}
+
+void latency_init(latency_t *l, const char *name)
+{
+	memset(l, 0, sizeof(latency_t));
+	l->name = name;
+}
+
+void latency_add(latency_t *l, int64_t ns)
+{
+	if(ns < 0) ns = 0;
+	
+	l->bins[_bin(ns)]++;
+	l->count++;
+	
+	if(ns > l->max) l->max = ns;
+}
+
+int64_t latency_percentile(const latency_t *l, double p)
+{
+	uint64_t n, target;
+	int b;
+	
+	if(l->count == 0) return(0);
+	
+	target = ceil(l->count * p / 100);
+	if(target < 1) target = 1;
+	
+	for(n = 0, b = 0; b < LATENCY_BINS; b++)
+	{
+		n += l->bins[b];
+		if(n >= target) break;
+	}
+	
+	/* Never report beyond the largest value seen */
+	return(_bin_limit(b) < l->max ? _bin_limit(b) : l->max);
+}
+
+void latency_report(FILE *f, const latency_t *l, int stages)
+{
+	int i;
+	
+	fprintf(f, "%-12s %8s %10s %10s %10s\n", "Latency", "count", "p50 ms", "p99 ms", "max ms");
+	
+	for(i = 0; i < stages; i++)
+	{
+		fprintf(f, "%-12s %8lu %10.2f %10.2f %10.2f\n",
+			l[i].name, (unsigned long) l[i].count,
+			latency_percentile(&l[i], 50) / 1e6,
+			latency_percentile(&l[i], 99) / 1e6,
+			l[i].max / 1e6
+		);
+	}
+}
+
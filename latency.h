@@ -0,0 +1,50 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Latency histograms. Bins are spaced logarithmically, 8 per octave,
+ * from 1µs up to about 70 seconds. Percentiles are reported as the
+ * upper edge of their bin, so are within about 9% */
+
+#define LATENCY_BINS 208
+
+typedef struct {
+	
+	const char *name;
+	uint32_t bins[LATENCY_BINS];
+	uint64_t count;
+	int64_t max;
+	
+} latency_t;
+
+extern void latency_init(latency_t *l, const char *name);
+extern void latency_add(latency_t *l, int64_t ns);
+
+/* The latency at percentile p (0 to 100), in nanoseconds */
+extern int64_t latency_percentile(const latency_t *l, double p);
+
+/* Print a table of p50 / p99 / max for each stage */
+extern void latency_report(FILE *f, const latency_t *l, int stages);
+
+#endif
+
@@ -0,0 +1,452 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Spectrum and signal quality overlay. The image is three strips:
+ *
+ * - A waterfall of the IQ spectrum, centred on the tuned frequency
+ * - A waterfall of the demodulated baseband, 0 Hz to half the sample rate
+ * - Per-line SNR bars for one frame, with the sync depth as dots
+ *
+ * The taps are handed over with a flag per tap. While a flag is set
+ * only the decoder thread touches that buffer, once cleared only the
+ * worker does. Neither side ever waits for the other.
+*/
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "scope.h"
+
+/* The largest FFT, used for the real demodulated samples */
+#define _FFT_MAX (SCOPE_FFT_SIZE * 2)
+
+/* The range shown by the waterfall, down from the peak */
+#define _RANGE_DB 60.0
+
+/* The SNR bars are full height at this level */
+#define _SNR_MAX_DB 50.0
+
+static uint32_t _palette[256];
+
+static void _init_palette(void)
+{
+	int i, r, g, b;
+	
+	/* Black, blue, red, yellow, white */
+	for(i = 0; i < 256; i++)
+	{
+		r = (i < 64 ? 0 : i < 128 ? (i - 64) * 4 : 255);
+		g = (i < 128 ? 0 : i < 192 ? (i - 128) * 4 : 255);
+		b = (i < 64 ? i * 4 : i < 128 ? 255 - (i - 64) * 4 : i < 192 ? 0 : (i - 192) * 4);
+		
+		_palette[i] = 0xE0000000 | r << 16 | g << 8 | b;
+	}
+}
+
+static void _fft(float *re, float *im, int n)
+{
+	float tr, ti, wr, wi;
+	int i, j, k, m;
+	
+	/* Bit reversal */
+	for(i = 1, j = 0; i < n; i++)
+	{
+		for(k = n >> 1; j & k; k >>= 1)
+		{
+			j ^= k;
+		}
+		
+		j |= k;
+		
+		if(i < j)
+		{
+			tr = re[i]; re[i] = re[j]; re[j] = tr;
+			ti = im[i]; im[i] = im[j]; im[j] = ti;
+		}
+	}
+	
+	/* Radix-2 butterflies */
+	for(m = 2; m <= n; m <<= 1)
+	{
+		for(k = 0; k < m / 2; k++)
+		{
+			wr = cos(-2.0 * M_PI * k / m);
+			wi = sin(-2.0 * M_PI * k / m);
+			
+			for(i = k; i < n; i += m)
+			{
+				j = i + m / 2;
+				tr = re[j] * wr - im[j] * wi;
+				ti = re[j] * wi + im[j] * wr;
+				re[j] = re[i] - tr;
+				im[j] = im[i] - ti;
+				re[i] += tr;
+				im[i] += ti;
+			}
+		}
+	}
+}
+
+static void _waterfall_row(uint32_t *row, const float *db)
+{
+	float mx;
+	int x, v;
+	
+	for(mx = db[0], x = 1; x < SCOPE_WIDTH; x++)
+	{
+		if(db[x] > mx) mx = db[x];
+	}
+	
+	for(x = 0; x < SCOPE_WIDTH; x++)
+	{
+		v = (db[x] - mx + _RANGE_DB) * 255 / _RANGE_DB;
+		row[x] = _palette[v < 0 ? 0 : (v > 255 ? 255 : v)];
+	}
+}
+
+static void _render_spectra(scope_t *s)
+{
+	float re[_FFT_MAX];
+	float im[_FFT_MAX];
+	float db[SCOPE_WIDTH];
+	float w;
+	int x, n;
+	
+	/* Scroll both waterfalls down a row */
+	memmove(s->image + SCOPE_WIDTH, s->image, SCOPE_WIDTH * (SCOPE_ROWS - 1) * sizeof(uint32_t));
+	memmove(s->image + SCOPE_WIDTH * (SCOPE_ROWS + 1), s->image + SCOPE_WIDTH * SCOPE_ROWS, SCOPE_WIDTH * (SCOPE_ROWS - 1) * sizeof(uint32_t));
+	
+	/* IQ, with DC moved to the centre */
+	n = SCOPE_FFT_SIZE;
+	
+	for(x = 0; x < n; x++)
+	{
+		w = 0.5 - 0.5 * cos(2.0 * M_PI * x / n);
+		re[x] = s->iq[x * 2 + 0] * w;
+		im[x] = s->iq[x * 2 + 1] * w;
+	}
+	
+	_fft(re, im, n);
+	
+	for(x = 0; x < n; x++)
+	{
+		db[(x + n / 2) % n] = 10 * log10(re[x] * re[x] + im[x] * im[x] + 1e-9);
+	}
+	
+	_waterfall_row(s->image, db);
+	
+	/* The demodulated signal is real, only the lower half is shown */
+	n = _FFT_MAX;
+	
+	for(x = 0; x < n; x++)
+	{
+		w = 0.5 - 0.5 * cos(2.0 * M_PI * x / n);
+		re[x] = s->demod[x] * w;
+		im[x] = 0;
+	}
+	
+	_fft(re, im, n);
+	
+	for(x = 0; x < SCOPE_WIDTH; x++)
+	{
+		db[x] = 10 * log10(re[x] * re[x] + im[x] * im[x] + 1e-9);
+	}
+	
+	_waterfall_row(s->image + SCOPE_WIDTH * SCOPE_ROWS, db);
+}
+
+static void _render_lines(scope_t *s, uint32_t *out)
+{
+	const double nominal = INT16_MAX * 0.3;
+	double snr, depth;
+	uint32_t c;
+	int x, y, l, h, d;
+	
+	for(x = 0; x < SCOPE_WIDTH * SCOPE_SNR_ROWS; x++)
+	{
+		out[x] = 0x80000000;
+	}
+	
+	for(x = 0; x < SCOPE_WIDTH; x++)
+	{
+		l = x * s->lines / SCOPE_WIDTH;
+		
+		/* SNR of the sync pulse, coloured red below 10 dB and yellow below 20 dB.
+		 * On noise the depth can be zero or negative, so floor it at one step */
+		depth = (s->depth[l] > 1 ? s->depth[l] : 1);
+		snr = (s->noise[l] > 0 ? 20 * log10(depth / s->noise[l]) : _SNR_MAX_DB);
+		h = (snr > 0 ? snr * SCOPE_SNR_ROWS / _SNR_MAX_DB : 0);
+		if(h > SCOPE_SNR_ROWS) h = SCOPE_SNR_ROWS;
+		
+		c = (snr < 10 ? 0xE0FF0000 : snr < 20 ? 0xE0FFFF00 : 0xE000C000);
+		
+		for(y = SCOPE_SNR_ROWS - h; y < SCOPE_SNR_ROWS; y++)
+		{
+			out[y * SCOPE_WIDTH + x] = c;
+		}
+		
+		/* Nominal sync depth is at three quarters height */
+		d = s->depth[l] * (SCOPE_SNR_ROWS * 3 / 4) / nominal;
+		y = SCOPE_SNR_ROWS - 1 - d;
+		
+		if(y >= 0 && y < SCOPE_SNR_ROWS)
+		{
+			out[y * SCOPE_WIDTH + x] = 0xFFFFFFFF;
+		}
+	}
+}
+
+static void _arm(scope_t *s)
+{
+	s->iq_len = 0;
+	s->demod_len = 0;
+	
+	__atomic_store_n(&s->want_iq, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&s->want_demod, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&s->want_lines, 1, __ATOMIC_RELEASE);
+}
+
+static void *_scope_thread(void *arg)
+{
+	scope_t *s = arg;
+	struct timespec ts;
+	uint32_t *p;
+	long ns;
+
+#ifdef SCHED_IDLE
+	struct sched_param param = { 0 };
+	
+	/* Only run when nothing else wants the CPU */
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+	ns = 1000000000L / s->rate;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	
+	pthread_mutex_lock(&s->mutex);
+	
+	while(!s->quit)
+	{
+		ts.tv_nsec += ns;
+		while(ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec++;
+		}
+		
+		pthread_cond_timedwait(&s->cond, &s->mutex, &ts);
+		if(s->quit) break;
+		
+		/* Wait for the next update if any tap is still filling */
+		if(__atomic_load_n(&s->want_iq, __ATOMIC_ACQUIRE) ||
+		   __atomic_load_n(&s->want_demod, __ATOMIC_ACQUIRE) ||
+		   __atomic_load_n(&s->want_lines, __ATOMIC_ACQUIRE))
+		{
+			continue;
+		}
+		
+		pthread_mutex_unlock(&s->mutex);
+		
+		_render_spectra(s);
+		memcpy(s->back, s->image, SCOPE_WIDTH * SCOPE_ROWS * 2 * sizeof(uint32_t));
+		_render_lines(s, s->back + SCOPE_WIDTH * SCOPE_ROWS * 2);
+		_arm(s);
+		
+		pthread_mutex_lock(&s->mutex);
+		
+		/* Publish the result */
+		p = s->ready;
+		s->ready = s->back;
+		s->back = p;
+		s->fresh = 1;
+		
+		/* Don't try to catch up after falling behind */
+		clock_gettime(CLOCK_REALTIME, &ts);
+	}
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(NULL);
+}
+
+void scope_free(scope_t *s)
+{
+	if(s->thread)
+	{
+		pthread_mutex_lock(&s->mutex);
+		s->quit = 1;
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->mutex);
+		
+		pthread_join(s->thread, NULL);
+		
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->mutex);
+	}
+	
+	free(s->depth);
+	free(s->noise);
+	free(s->image);
+	free(s->front);
+	free(s->ready);
+	free(s->back);
+	
+	memset(s, 0, sizeof(scope_t));
+}
+
+int scope_init(scope_t *s, int rate, int lines)
+{
+	int len = SCOPE_WIDTH * SCOPE_HEIGHT;
+	int i;
+	
+	memset(s, 0, sizeof(scope_t));
+	
+	if(rate < 1) rate = 1;
+	if(rate > 100) rate = 100;
+	
+	s->rate = rate;
+	s->lines = lines;
+	
+	s->depth = calloc(lines, sizeof(int));
+	s->noise = calloc(lines, sizeof(int));
+	s->image = malloc(len * sizeof(uint32_t));
+	s->front = malloc(len * sizeof(uint32_t));
+	s->ready = malloc(len * sizeof(uint32_t));
+	s->back = malloc(len * sizeof(uint32_t));
+	
+	if(!s->depth || !s->noise || !s->image || !s->front || !s->ready || !s->back)
+	{
+		perror("malloc");
+		scope_free(s);
+		return(-1);
+	}
+	
+	_init_palette();
+	
+	for(i = 0; i < len; i++)
+	{
+		s->image[i] = s->front[i] = _palette[0];
+	}
+	
+	_arm(s);
+	
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	
+	if(pthread_create(&s->thread, NULL, _scope_thread, (void *) s) != 0)
+	{
+		perror("pthread_create");
+		s->thread = 0;
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->mutex);
+		scope_free(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void scope_feed_iq(scope_t *s, const int16_t *iq, int samples)
+{
+	if(!__atomic_load_n(&s->want_iq, __ATOMIC_ACQUIRE)) return;
+	
+	if(samples > SCOPE_FFT_SIZE - s->iq_len)
+	{
+		samples = SCOPE_FFT_SIZE - s->iq_len;
+	}
+	
+	memcpy(s->iq + s->iq_len * 2, iq, samples * 2 * sizeof(int16_t));
+	s->iq_len += samples;
+	
+	if(s->iq_len == SCOPE_FFT_SIZE)
+	{
+		__atomic_store_n(&s->want_iq, 0, __ATOMIC_RELEASE);
+	}
+}
+
+void scope_feed_demod(scope_t *s, const int16_t *demod, int samples)
+{
+	if(!__atomic_load_n(&s->want_demod, __ATOMIC_ACQUIRE)) return;
+	
+	if(samples > _FFT_MAX - s->demod_len)
+	{
+		samples = _FFT_MAX - s->demod_len;
+	}
+	
+	memcpy(s->demod + s->demod_len, demod, samples * sizeof(int16_t));
+	s->demod_len += samples;
+	
+	if(s->demod_len == _FFT_MAX)
+	{
+		__atomic_store_n(&s->want_demod, 0, __ATOMIC_RELEASE);
+	}
+}
+
+void scope_line(scope_t *s, const usbtv_line_t *line)
+{
+	int w;
+	
+	/* 1 is armed and waiting for the start of a frame, 2 recording */
+	w = __atomic_load_n(&s->want_lines, __ATOMIC_ACQUIRE);
+	if(w == 0) return;
+	
+	if(line->line == 1)
+	{
+		w = 2;
+		__atomic_store_n(&s->want_lines, w, __ATOMIC_RELAXED);
+	}
+	
+	if(w != 2 || line->line < 1 || line->line > s->lines) return;
+	
+	s->depth[line->line - 1] = line->sync_depth;
+	s->noise[line->line - 1] = line->noise;
+	
+	if(line->line == s->lines)
+	{
+		__atomic_store_n(&s->want_lines, 0, __ATOMIC_RELEASE);
+	}
+}
+
+const uint32_t *scope_output(scope_t *s)
+{
+	uint32_t *p;
+	
+	/* The worker runs at idle priority, don't wait on it */
+	if(pthread_mutex_trylock(&s->mutex) != 0) return(NULL);
+	
+	if(!s->fresh)
+	{
+		pthread_mutex_unlock(&s->mutex);
+		return(NULL);
+	}
+	
+	p = s->front;
+	s->front = s->ready;
+	s->ready = p;
+	s->fresh = 0;
+	
+	pthread_mutex_unlock(&s->mutex);
+	
+	return(s->front);
+}
+
@@ -0,0 +1,83 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _SCOPE_H
+#define _SCOPE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "usbtv.h"
+
+/* Spectrum waterfall and signal quality overlay. The decoder thread
+ * copies a short snapshot of the IQ and demodulated samples, and one
+ * frame of line measurements, only when the worker asks for them.
+ * The FFTs and drawing happen on a low priority worker thread */
+
+#define SCOPE_FFT_SIZE 512
+#define SCOPE_ROWS     96
+#define SCOPE_SNR_ROWS 64
+
+#define SCOPE_WIDTH  SCOPE_FFT_SIZE
+#define SCOPE_HEIGHT (SCOPE_ROWS * 2 + SCOPE_SNR_ROWS)
+
+typedef struct {
+	
+	int rate;
+	int lines;
+	
+	/* Taps, written by the decoder thread while armed */
+	int want_iq;
+	int want_demod;
+	int want_lines;
+	int iq_len;
+	int demod_len;
+	int16_t iq[SCOPE_FFT_SIZE * 2];
+	int16_t demod[SCOPE_FFT_SIZE * 2];
+	int *depth;
+	int *noise;
+	
+	/* Waterfall history, worker only */
+	uint32_t *image;
+	
+	/* Triple-buffered output */
+	uint32_t *front;
+	uint32_t *ready;
+	uint32_t *back;
+	int fresh;
+	
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	
+} scope_t;
+
+extern int scope_init(scope_t *s, int rate, int lines);
+extern void scope_free(scope_t *s);
+
+/* Decoder side taps. These never block, and only copy samples when
+ * the worker has asked for a new snapshot */
+extern void scope_feed_iq(scope_t *s, const int16_t *iq, int samples);
+extern void scope_feed_demod(scope_t *s, const int16_t *demod, int samples);
+extern void scope_line(scope_t *s, const usbtv_line_t *line);
+
+/* The latest ARGB image, SCOPE_WIDTH x SCOPE_HEIGHT, or
+ * NULL if nothing has changed since the last call */
+extern const uint32_t *scope_output(scope_t *s);
+
+#endif
+
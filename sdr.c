@@ -16,6 +16,7 @@
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <stdint.h>
+#include <time.h>
 #include "sdr.h"
 
 int sdr_read(sdr_t *d, int16_t *buffer, int samples)
@@ -30,3 +31,12 @@ void sdr_close(sdr_t *d)
 	if(d && d->close) d->close(d);
 }
 
+int64_t sdr_clock(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
@@ -22,6 +22,14 @@ typedef struct _sdr_t {
 	
 	void *_priv;
 	
+	/* Monotonic arrival time of the first sample
+	 * returned by the last read, in nanoseconds */
+	int64_t timestamp;
+	
+	/* Samples lost immediately before those returned by
+	 * the last read, such as from a buffer overflow */
+	int64_t dropped;
+	
 	int (*read)(struct _sdr_t *d, int16_t *buffer, int samples);
 	void (*close)(struct _sdr_t *d);
 	
@@ -30,6 +38,9 @@ typedef struct _sdr_t {
 extern int  sdr_read(sdr_t *d, int16_t *buffer, int samples);
 extern void sdr_close(sdr_t *d);
 
+/* The monotonic clock used for timestamps, in nanoseconds */
+extern int64_t sdr_clock(void);
+
 #include "sdr_file.h"
 #include "sdr_rtlsdr.h"
 
@@ -17,11 +17,57 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "sdr.h"
+#include "iqz.h"
+
+/* Compressed captures (see iqz.h) are decoded ahead of the reader by
+ * a pool of threads, one per CPU by default. Each takes the next block
+ * from the file in turn, then decodes it into its slot of a ring while
+ * the others read and decode the following blocks. The ring holds two
+ * blocks per thread so the reader never waits on a slow block.
+ *
+ * File reads are serialised by their own lock, so the state lock is
+ * never held over I/O. The reader only takes the state lock to wait
+ * for a new block and to return a finished one */
+
+enum {
+	_SLOT_FREE,
+	_SLOT_BUSY,             /* Being read or decoded */
+	_SLOT_READY,
+	_SLOT_END,              /* The end of the file, or an error */
+};
+
+typedef struct {
+	int state;
+	iqz_block_t b;
+	uint8_t *in;
+	uint8_t *iq;
+} _slot_t;
 
 typedef struct {
 	FILE *f;
+	
+	/* Compressed input */
+	int iqz;
+	uint32_t block;
+	pthread_t *threads;
+	int nthreads;
+	pthread_mutex_t io;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int quit;
+	int eof;
+	
+	_slot_t *slots;
+	int nslots;
+	int64_t next;           /* The next block to take from the file */
+	int64_t cur;            /* The block being read out */
+	int cur_state;          /* Its state, once ready or ended */
+	int pos;                /* Samples read out of it */
 } _state_t;
 
 static int _sdr_read(sdr_t *d, int16_t *buffer, int samples)
@@ -30,6 +76,8 @@ static int _sdr_read(sdr_t *d, int16_t *buffer, int samples)
 	uint8_t buf[2048];
 	int i;
 	
+	d->timestamp = sdr_clock();
+	d->dropped = 0;
 	samples = fread(buf, sizeof(int8_t) * 2, samples, s->f);
 	
 	for(i = 0; i < samples * 2; i++)
@@ -40,16 +88,256 @@ static int _sdr_read(sdr_t *d, int16_t *buffer, int samples)
 	return(samples);
 }
 
+/* Read the next block into a slot. Called with the I/O lock held, so blocks are taken in order */
+static int _read_block(_state_t *s, _slot_t *b)
+{
+	if(iqz_read_block(s->f, &b->b) != 0)
+	{
+		return(-1);
+	}
+	
+	if(b->b.samples == 0 || b->b.samples > s->block ||
+	   b->b.bytes > IQZ_MAX_BYTES(b->b.samples))
+	{
+		fprintf(stderr, "Corrupt block in compressed input.\n");
+		return(-1);
+	}
+	
+	if(fread(b->in, 1, b->b.bytes, s->f) != b->b.bytes)
+	{
+		fprintf(stderr, "Compressed input is truncated.\n");
+		return(-1);
+	}
+	
+	return(0);
+}
+
+static void *_iqz_thread(void *arg)
+{
+	_state_t *s = arg;
+	_slot_t *b;
+	int r;
+	
+	for(;;)
+	{
+		/* Claim the next slot and fill it from the file, in order */
+		pthread_mutex_lock(&s->io);
+		pthread_mutex_lock(&s->lock);
+		
+		while(!s->quit && !s->eof && s->slots[s->next % s->nslots].state != _SLOT_FREE)
+		{
+			pthread_cond_wait(&s->cond, &s->lock);
+		}
+		
+		if(s->quit || s->eof)
+		{
+			pthread_mutex_unlock(&s->lock);
+			pthread_mutex_unlock(&s->io);
+			break;
+		}
+		
+		b = &s->slots[s->next++ % s->nslots];
+		b->state = _SLOT_BUSY;
+		
+		pthread_mutex_unlock(&s->lock);
+		
+		r = _read_block(s, b);
+		
+		pthread_mutex_unlock(&s->io);
+		
+		if(r == 0)
+		{
+			r = iqz_decode(&b->b, b->in, b->iq);
+			if(r != 0)
+			{
+				fprintf(stderr, "Error decoding compressed input.\n");
+			}
+		}
+		
+		pthread_mutex_lock(&s->lock);
+		
+		/* The reader stops at a slot that failed */
+		b->state = (r == 0 ? _SLOT_READY : _SLOT_END);
+		if(r != 0) s->eof = 1;
+		pthread_cond_broadcast(&s->cond);
+		
+		pthread_mutex_unlock(&s->lock);
+	}
+	
+	return(NULL);
+}
+
+static int _sdr_read_iqz(sdr_t *d, int16_t *buffer, int samples)
+{
+	_state_t *s = d->_priv;
+	_slot_t *b = &s->slots[s->cur % s->nslots];
+	int i;
+	
+	d->timestamp = sdr_clock();
+	d->dropped = 0;
+	
+	if(s->cur_state == _SLOT_FREE)
+	{
+		pthread_mutex_lock(&s->lock);
+		
+		while(b->state == _SLOT_FREE || b->state == _SLOT_BUSY)
+		{
+			pthread_cond_wait(&s->cond, &s->lock);
+		}
+		
+		s->cur_state = b->state;
+		
+		pthread_mutex_unlock(&s->lock);
+	}
+	
+	if(s->cur_state == _SLOT_END)
+	{
+		return(0);
+	}
+	
+	if(samples > (int) b->b.samples - s->pos)
+	{
+		samples = (int) b->b.samples - s->pos;
+	}
+	
+	for(i = 0; i < samples * 2; i++)
+	{
+		buffer[i] = b->iq[s->pos * 2 + i] + INT8_MIN;
+	}
+	
+	s->pos += samples;
+	
+	if(s->pos == (int) b->b.samples)
+	{
+		/* Return the slot to the pool */
+		pthread_mutex_lock(&s->lock);
+		b->state = _SLOT_FREE;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		
+		s->cur++;
+		s->cur_state = _SLOT_FREE;
+		s->pos = 0;
+	}
+	
+	return(samples);
+}
+
+/* Stop the decode threads and free the ring. Safe to call
+ * on a partly opened state, undoing only what was done */
+static void _close_iqz(_state_t *s)
+{
+	int i;
+	
+	if(s->nthreads > 0)
+	{
+		pthread_mutex_lock(&s->lock);
+		s->quit = 1;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+		
+		for(i = 0; i < s->nthreads; i++)
+		{
+			pthread_join(s->threads[i], NULL);
+		}
+	}
+	
+	if(s->slots)
+	{
+		for(i = 0; i < s->nslots; i++)
+		{
+			free(s->slots[i].in);
+			free(s->slots[i].iq);
+		}
+	}
+	
+	free(s->slots);
+	free(s->threads);
+	
+	pthread_mutex_destroy(&s->io);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+}
+
 static void _sdr_close(sdr_t *d)
 {
 	_state_t *s = d->_priv;
+	
+	if(s->iqz)
+	{
+		_close_iqz(s);
+	}
+	
 	fclose(s->f);
 	free(s);
 }
 
-int sdr_open_file(sdr_t *d, const char *name)
+static int _open_iqz(_state_t *s, const iqz_header_t *h, int threads)
+{
+	int i, n;
+	
+	if(h->version != IQZ_VERSION || h->block == 0 || h->block > IQZ_BLOCK_MAX)
+	{
+		fprintf(stderr, "Unsupported compressed input.\n");
+		return(-1);
+	}
+	
+	pthread_mutex_init(&s->io, NULL);
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	
+	s->iqz = 1;
+	s->block = h->block;
+	s->cur_state = _SLOT_FREE;
+	
+	n = (threads > 0 ? threads : sysconf(_SC_NPROCESSORS_ONLN));
+	if(n < 1) n = 1;
+	s->nslots = n * 2;
+	
+	s->threads = calloc(n, sizeof(pthread_t));
+	s->slots = calloc(s->nslots, sizeof(_slot_t));
+	if(!s->threads || !s->slots)
+	{
+		perror("calloc");
+		_close_iqz(s);
+		return(-1);
+	}
+	
+	for(i = 0; i < s->nslots; i++)
+	{
+		s->slots[i].in = malloc(IQZ_MAX_BYTES(s->block));
+		s->slots[i].iq = malloc(s->block * 2);
+		if(!s->slots[i].in || !s->slots[i].iq)
+		{
+			perror("malloc");
+			_close_iqz(s);
+			return(-1);
+		}
+	}
+	
+	for(s->nthreads = 0; s->nthreads < n; s->nthreads++)
+	{
+		if(pthread_create(&s->threads[s->nthreads], NULL, _iqz_thread, s) != 0)
+		{
+			perror("pthread_create");
+			break;
+		}
+	}
+	
+	/* Carry on with the threads that did start */
+	if(s->nthreads == 0)
+	{
+		_close_iqz(s);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+int sdr_open_file(sdr_t *d, const char *name, int threads)
 {
 	_state_t *s;
+	iqz_header_t h;
 	
 	s = calloc(sizeof(_state_t), 1);
 	if(!s)
@@ -62,6 +350,7 @@ int sdr_open_file(sdr_t *d, const char *name)
 	if(!s->f)
 	{
 		perror("fopen");
+		free(s);
 		return(-1);
 	}
 	
@@ -70,6 +359,22 @@ int sdr_open_file(sdr_t *d, const char *name)
 	d->read  = &_sdr_read;
 	d->close = &_sdr_close;
 	
+	/* Compressed captures start with a magic number, anything else is raw */
+	if(iqz_read_header(s->f, &h) == 0 && h.magic == IQZ_MAGIC)
+	{
+		if(_open_iqz(s, &h, threads) != 0)
+		{
+			fclose(s->f);
+			free(s);
+			return(-1);
+		}
+		
+		d->read = &_sdr_read_iqz;
+	}
+	else
+	{
+		rewind(s->f);
+	}
+	
 	return(0);
 }
-
@@ -18,7 +18,9 @@
 #ifndef _SDR_FILE_H
 #define _SDR_FILE_H
 
-extern int sdr_open_file(sdr_t *s, const char *name);
+/* Open a raw or compressed (iqz.h) capture. Compressed captures are
+ * decoded on this many threads, or one per CPU for 0 */
+extern int sdr_open_file(sdr_t *s, const char *name, int threads);
 
 #endif
 
@@ -32,11 +32,15 @@ typedef struct {
 	pthread_t thread;
 	
 	int16_t buf[BUF_COUNT][BUF_LEN];
+	int64_t buf_time[BUF_COUNT];
+	int64_t buf_dropped[BUF_COUNT];
 	pthread_mutex_t mutex[BUF_COUNT];
 	int buf_len;
 	int in;
 	int out;
 	
+	uint32_t sample_rate;
+	
 } _state_t;
 
 static void _rx_callback(uint8_t *buf, uint32_t len, void *ctx)
@@ -49,6 +53,8 @@ static void _rx_callback(uint8_t *buf, uint32_t len, void *ctx)
 		fprintf(stderr, "BUF_LEN != len (%d != %d)\n", BUF_LEN, len);
 	}
 	
+	s->buf_time[s->in] = sdr_clock();
+	
 	for(i = 0; i < BUF_LEN; i++)
 	{
 		s->buf[s->in][i] = (int16_t) buf[i] + INT8_MIN;
@@ -59,12 +65,15 @@ static void _rx_callback(uint8_t *buf, uint32_t len, void *ctx)
 	
 	if(pthread_mutex_trylock(&s->mutex[i]) != 0)
 	{
-		/* No luck, the reader must have it */
+		/* No luck, the reader must have it. This buffer
+		 * will be overwritten, record the loss */
+		s->buf_dropped[s->in] += BUF_LEN / 2;
 		fprintf(stderr, "O");
 		return;
 	}
 	
 	/* Got a lock on the next buffer, release the previous */
+	s->buf_dropped[i] = 0;
 	pthread_mutex_unlock(&s->mutex[s->in]);
 	s->in = i;
 }
@@ -83,6 +92,8 @@ static int _sdr_read(sdr_t *d, int16_t *buffer, int samples)
 	_state_t *s = d->_priv;
 	int i;
 	
+	d->dropped = 0;
+	
 	/* If the current output buffer is empty, try to move on */
 	if(s->buf_len == 0)
 	{
@@ -97,6 +108,9 @@ static int _sdr_read(sdr_t *d, int16_t *buffer, int samples)
 		
 		s->out = i;
 		s->buf_len = BUF_LEN;
+		
+		/* Any loss is reported with the first read of the buffer */
+		d->dropped = s->buf_dropped[i];
 	}
 	
 	samples *= 2;
@@ -111,6 +125,9 @@ static int _sdr_read(sdr_t *d, int16_t *buffer, int samples)
 		buffer[i] = s->buf[s->out][BUF_LEN - s->buf_len + i];
 	}
 	
+	/* Buffers are timed when the callback runs, as their last sample
+	 * arrives. Step back to the first sample returned by this read */
+	d->timestamp = s->buf_time[s->out] - (int64_t) (s->buf_len / 2) * 1000000000LL / s->sample_rate;
 	s->buf_len -= samples;
 	
 	return(samples / 2);
@@ -148,6 +165,7 @@ int sdr_open_rtlsdr(sdr_t *d, uint32_t index, uint32_t sample_rate, uint64_t fre
 	}
 	
 	rtlsdr_set_sample_rate(s->dev, sample_rate);
+	s->sample_rate = sample_rate;
 	
 	/* Enable AGC */
 	rtlsdr_set_agc_mode(s->dev, 1);
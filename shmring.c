@@ -0,0 +1,310 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "shmring.h"
+
+#ifdef __linux__
+
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Slots and frame data start on cache line boundaries */
+#define _ALIGN(x) (((x) + 63) & ~(size_t) 63)
+
+static void _futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void _futex_wait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static shmring_slot_t *_slot(const shmring_t *r, uint32_t seq)
+{
+	const shmring_header_t *h = r->header;
+	
+	return((shmring_slot_t *) (r->map + _ALIGN(sizeof(shmring_header_t)) + (size_t) (seq % h->slots) * h->slot_size));
+}
+
+int shmring_create(shmring_t *r, const char *name, int slots, const usbtv_t *tv)
+{
+	shmring_header_t *h;
+	size_t frame_len;
+	
+	memset(r, 0, sizeof(shmring_t));
+	r->fd = -1;
+	
+	if(slots < 2) slots = 2;
+	
+	r->name = strdup(name);
+	if(!r->name)
+	{
+		perror("strdup");
+		return(-1);
+	}
+	
+	r->writer = 1;
+	frame_len = (size_t) tv->framebuffer_len;
+	r->size = _ALIGN(sizeof(shmring_header_t)) + slots * (_ALIGN(sizeof(shmring_slot_t)) + _ALIGN(frame_len));
+	
+	/* Start from a fresh object, readers of an old one keep their mapping */
+	shm_unlink(name);
+	
+	r->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(r->fd < 0)
+	{
+		perror("shm_open");
+		shmring_close(r);
+		return(-1);
+	}
+	
+	if(ftruncate(r->fd, r->size) < 0)
+	{
+		perror("ftruncate");
+		shmring_close(r);
+		return(-1);
+	}
+	
+	r->map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if(r->map == MAP_FAILED)
+	{
+		perror("mmap");
+		r->map = NULL;
+		shmring_close(r);
+		return(-1);
+	}
+	
+	/* The new object is zero filled, so every slot starts unlocked and empty */
+	h = r->header = (shmring_header_t *) r->map;
+	h->version = SHMRING_VERSION;
+	h->slots = slots;
+	h->data_offset = _ALIGN(sizeof(shmring_slot_t));
+	h->slot_size = h->data_offset + _ALIGN(frame_len);
+	h->width = tv->active_width;
+	h->height = tv->active_lines;
+	h->bytes_per_pixel = tv->bytes_per_pixel;
+	h->stride = tv->active_width * tv->bytes_per_pixel;
+	h->colour = tv->colour;
+	h->frame_rate_num = tv->frame_rate_num;
+	h->frame_rate_den = tv->frame_rate_den;
+	h->seq = 0;
+	
+	/* Readers check the magic last */
+	__atomic_store_n(&h->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+	
+	return(0);
+}
+
+void shmring_publish(shmring_t *r, const usbtv_frame_t *frame)
+{
+	shmring_header_t *h = r->header;
+	shmring_slot_t *s;
+	uint32_t seq, lock;
+	
+	seq = h->seq + 1;
+	if(seq == 0) seq = 1;
+	
+	s = _slot(r, seq);
+	
+	/* Lock the slot, odd while the frame is being written. The fence
+	 * keeps the frame writes from being seen before the lock */
+	lock = s->lock;
+	__atomic_store_n(&s->lock, lock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	s->seq = seq;
+	s->frame = frame->frame;
+	s->field = frame->field;
+	s->fsc = frame->fsc;
+	s->first_row = frame->first_row;
+	s->row_step = frame->row_step;
+	memcpy((uint8_t *) s + h->data_offset, frame->framebuffer, frame->stride * frame->height);
+	
+	__atomic_store_n(&s->lock, lock + 2, __ATOMIC_RELEASE);
+	
+	/* Announce it */
+	__atomic_store_n(&h->seq, seq, __ATOMIC_RELEASE);
+	_futex_wake(&h->seq);
+}
+
+int shmring_open(shmring_t *r, const char *name)
+{
+	struct stat st;
+	
+	memset(r, 0, sizeof(shmring_t));
+	
+	r->fd = shm_open(name, O_RDONLY, 0);
+	if(r->fd < 0)
+	{
+		perror("shm_open");
+		return(-1);
+	}
+	
+	if(fstat(r->fd, &st) < 0 || st.st_size < (off_t) sizeof(shmring_header_t))
+	{
+		fprintf(stderr, "Frame ring '%s' is not ready.\n", name);
+		shmring_close(r);
+		return(-1);
+	}
+	
+	r->size = st.st_size;
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if(r->map == MAP_FAILED)
+	{
+		perror("mmap");
+		r->map = NULL;
+		shmring_close(r);
+		return(-1);
+	}
+	
+	r->header = (shmring_header_t *) r->map;
+	
+	if(__atomic_load_n(&r->header->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC ||
+	   r->header->version != SHMRING_VERSION)
+	{
+		fprintf(stderr, "Frame ring '%s' has an unrecognised format.\n", name);
+		shmring_close(r);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void shmring_close(shmring_t *r)
+{
+	if(r->map)
+	{
+		munmap(r->map, r->size);
+	}
+	
+	if(r->fd >= 0)
+	{
+		close(r->fd);
+	}
+	
+	if(r->writer && r->name)
+	{
+		shm_unlink(r->name);
+	}
+	
+	free(r->name);
+	
+	memset(r, 0, sizeof(shmring_t));
+	r->fd = -1;
+}
+
+uint32_t shmring_wait(shmring_t *r, uint32_t seq, int timeout_ms)
+{
+	struct timespec ts, *t = NULL;
+	uint32_t s;
+	
+	if(timeout_ms >= 0)
+	{
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+		t = &ts;
+	}
+	
+	s = __atomic_load_n(&r->header->seq, __ATOMIC_ACQUIRE);
+	
+	if(s == seq)
+	{
+		/* Returns straight away if seq has already moved on. A signal
+		 * or spurious wake-up is reported the same as a timeout */
+		_futex_wait(&r->header->seq, seq, t);
+		s = __atomic_load_n(&r->header->seq, __ATOMIC_ACQUIRE);
+	}
+	
+	return(s);
+}
+
+#else
+
+/* Shared memory output is only implemented for Linux */
+int shmring_create(shmring_t *r, const char *name, int slots, const usbtv_t *tv)
+{
+	memset(r, 0, sizeof(shmring_t));
+	fprintf(stderr, "Shared memory output is not supported on this platform.\n");
+	return(-1);
+}
+
+void shmring_publish(shmring_t *r, const usbtv_frame_t *frame)
+{
+}
+
+int shmring_open(shmring_t *r, const char *name)
+{
+	memset(r, 0, sizeof(shmring_t));
+	fprintf(stderr, "Shared memory output is not supported on this platform.\n");
+	return(-1);
+}
+
+void shmring_close(shmring_t *r)
+{
+}
+
+uint32_t shmring_wait(shmring_t *r, uint32_t seq, int timeout_ms)
+{
+	return(seq);
+}
+
+static shmring_slot_t *_slot(const shmring_t *r, uint32_t seq)
+{
+	return(NULL);
+}
+
+#endif
+
+const shmring_slot_t *shmring_slot(const shmring_t *r, uint32_t seq)
+{
+	return(_slot(r, seq));
+}
+
+const uint8_t *shmring_data(const shmring_t *r, const shmring_slot_t *slot)
+{
+	return((const uint8_t *) slot + r->header->data_offset);
+}
+
+uint32_t shmring_begin(const shmring_slot_t *slot)
+{
+	return(__atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE));
+}
+
+int shmring_end(const shmring_slot_t *slot, uint32_t lock, uint32_t seq)
+{
+	/* Keep the frame reads from moving past the second lock check */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	
+	if(lock & 1) return(0);
+	if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) return(0);
+	
+	return(__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) == lock);
+}
+
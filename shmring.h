@@ -0,0 +1,115 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "usbtv.h"
+
+/* A ring of decoded frames in POSIX shared memory, for other local
+ * processes to read in place. The writer never waits for readers.
+ *
+ * Each slot is guarded by a sequence lock, odd while the writer is
+ * copying a frame in. A reader notes the lock value, reads the frame
+ * from the mapping, then checks the lock hasn't changed. If it has,
+ * the slot was reused while being read and the result is discarded.
+ *
+ * The header's seq word is the number of the last published frame,
+ * starting from 1. Readers can sleep on it with a futex. Frame n is
+ * in slot n % slots.
+*/
+
+#define SHMRING_MAGIC   0x52565441 /* "ATVR" */
+#define SHMRING_VERSION 1
+
+typedef struct {
+	
+	uint32_t magic;
+	uint32_t version;
+	
+	uint32_t slots;
+	uint32_t slot_size;     /* Bytes from one slot to the next */
+	uint32_t data_offset;   /* Frame data from the start of a slot */
+	
+	/* The frame layout, as usbtv_frame_t */
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytes_per_pixel;
+	uint32_t stride;
+	
+	uint32_t colour;
+	uint32_t frame_rate_num;
+	uint32_t frame_rate_den;
+	
+	/* The last published frame, 0 for none yet */
+	uint32_t seq;
+	
+} shmring_header_t;
+
+typedef struct {
+	
+	uint32_t lock;
+	uint32_t seq;
+	
+	/* As usbtv_frame_t */
+	int32_t frame;
+	int32_t field;
+	int32_t fsc;
+	int32_t first_row;
+	int32_t row_step;
+	
+} shmring_slot_t;
+
+typedef struct {
+	
+	char *name;
+	int writer;
+	int fd;
+	size_t size;
+	uint8_t *map;
+	shmring_header_t *header;
+	
+} shmring_t;
+
+/* Writer. Creates the named object, replacing any old one, and
+ * removes it again on close */
+extern int shmring_create(shmring_t *r, const char *name, int slots, const usbtv_t *tv);
+extern void shmring_publish(shmring_t *r, const usbtv_frame_t *frame);
+
+/* Reader */
+extern int shmring_open(shmring_t *r, const char *name);
+extern void shmring_close(shmring_t *r);
+
+/* Wait up to timeout_ms (or forever if < 0) for a frame after seq,
+ * and return the latest sequence number. Returns seq on a timeout */
+extern uint32_t shmring_wait(shmring_t *r, uint32_t seq, int timeout_ms);
+
+/* The slot and frame data for sequence number seq */
+extern const shmring_slot_t *shmring_slot(const shmring_t *r, uint32_t seq);
+extern const uint8_t *shmring_data(const shmring_t *r, const shmring_slot_t *slot);
+
+/* Bracket reads of a slot. shmring_begin() returns the lock value to
+ * pass to shmring_end(), which returns 1 if the slot still holds
+ * frame seq and was not written to in between, or 0 */
+extern uint32_t shmring_begin(const shmring_slot_t *slot);
+extern int shmring_end(const shmring_slot_t *slot, uint32_t lock, uint32_t seq);
+
+#endif
+
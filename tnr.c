@@ -0,0 +1,374 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Temporal noise reduction for weak signals. Two filters are offered:
+ *
+ * TNR_RECURSIVE - a first order IIR, out += (in - out) / frames
+ * TNR_STACK     - the mean of the last n frames
+ *
+ * Each submitted frame only replaces the bytes selected by a row step
+ * and byte mask. In colour mode this is one colour of one field, so
+ * every field of the sequence is stacked only with its own history.
+ *
+ * The kernels use the GCC vector extensions and process 16 bytes at
+ * a time, with a scalar loop for the remainder of each row.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "tnr.h"
+
+typedef uint8_t  _v16u8  __attribute__ ((vector_size (16)));
+typedef uint16_t _v16u16 __attribute__ ((vector_size (32)));
+typedef int32_t  _v16i32 __attribute__ ((vector_size (64)));
+typedef uint32_t _v16u32 __attribute__ ((vector_size (64)));
+
+static void _stack_row(tnr_t *t, uint16_t *sum, uint8_t *hist, const uint8_t *in, uint32_t mask)
+{
+	_v16u8 vm, vi, vh, vn;
+	_v16u16 vs;
+	uint8_t m;
+	int x;
+	
+	for(x = 0; x < 16; x++)
+	{
+		vm[x] = mask >> ((x & 3) * 8);
+	}
+	
+	for(x = 0; x + 16 <= t->stride; x += 16)
+	{
+		memcpy(&vi, in + x, 16);
+		memcpy(&vh, hist + x, 16);
+		memcpy(&vs, sum + x, 32);
+		
+		/* Bytes outside the mask keep their history, leaving the sum unchanged */
+		vn = (vi & vm) | (vh & ~vm);
+		vs += __builtin_convertvector(vn, _v16u16);
+		vs -= __builtin_convertvector(vh, _v16u16);
+		
+		memcpy(hist + x, &vn, 16);
+		memcpy(sum + x, &vs, 32);
+	}
+	
+	for(; x < t->stride; x++)
+	{
+		m = mask >> ((x & 3) * 8);
+		if(m == 0) continue;
+		
+		sum[x] += in[x] - hist[x];
+		hist[x] = in[x];
+	}
+}
+
+static void _stack_render(tnr_t *t, uint8_t *out)
+{
+	const uint32_t r = (65536 + t->frames / 2) / t->frames;
+	_v16u32 vs;
+	_v16u16 v;
+	_v16u8 vo;
+	int x;
+	
+	for(x = 0; x + 16 <= t->len; x += 16)
+	{
+		memcpy(&v, t->acc + x, 32);
+		
+		vs = __builtin_convertvector(v, _v16u32);
+		vs = (vs * r + 32768) >> 16;
+		
+		v = __builtin_convertvector(vs, _v16u16);
+		vo = __builtin_convertvector(v, _v16u8);
+		memcpy(out + x, &vo, 16);
+	}
+	
+	for(; x < t->len; x++)
+	{
+		out[x] = (t->acc[x] * r + 32768) >> 16;
+	}
+}
+
+static void _recursive_row(tnr_t *t, uint16_t *acc, const uint8_t *in, uint32_t mask)
+{
+	const int32_t k = (256 + t->frames / 2) / t->frames;
+	_v16u8 vm, vi;
+	_v16u16 va;
+	_v16i32 a, d, m;
+	int x;
+	
+	for(x = 0; x < 16; x++)
+	{
+		vm[x] = mask >> ((x & 3) * 8);
+	}
+	
+	m = __builtin_convertvector(vm, _v16i32) != 0;
+	
+	for(x = 0; x + 16 <= t->stride; x += 16)
+	{
+		memcpy(&vi, in + x, 16);
+		memcpy(&va, acc + x, 32);
+		
+		/* acc is 8.8 fixed point */
+		a = __builtin_convertvector(va, _v16i32);
+		d = (__builtin_convertvector(vi, _v16i32) << 8) - a;
+		a += ((d * k) >> 8) & m;
+		
+		va = __builtin_convertvector(a, _v16u16);
+		memcpy(acc + x, &va, 32);
+	}
+	
+	for(; x < t->stride; x++)
+	{
+		if(((mask >> ((x & 3) * 8)) & 0xFF) == 0) continue;
+		
+		acc[x] += (((in[x] << 8) - acc[x]) * k) >> 8;
+	}
+}
+
+static void _recursive_render(tnr_t *t, uint8_t *out)
+{
+	_v16u16 v;
+	_v16u8 vo;
+	int x;
+	
+	for(x = 0; x + 16 <= t->len; x += 16)
+	{
+		memcpy(&v, t->acc + x, 32);
+		v = (v + 128) >> 8;
+		vo = __builtin_convertvector(v, _v16u8);
+		memcpy(out + x, &vo, 16);
+	}
+	
+	for(; x < t->len; x++)
+	{
+		out[x] = (t->acc[x] + 128) >> 8;
+	}
+}
+
+static void _tnr_prime(tnr_t *t, const uint8_t *in)
+{
+	int i;
+	
+	for(i = 0; i < t->len; i++)
+	{
+		t->acc[i] = (t->mode == TNR_STACK ? in[i] * t->frames : in[i] << 8);
+	}
+	
+	if(t->mode == TNR_STACK)
+	{
+		for(i = 0; i < t->frames; i++)
+		{
+			memcpy(t->history + i * t->len, in, t->len);
+		}
+	}
+	
+	t->primed = 1;
+}
+
+static void _tnr_process(tnr_t *t, const uint8_t *in, int row, int step, uint32_t mask)
+{
+	uint8_t *hist;
+	int plane;
+	int y;
+	
+	if(!t->primed)
+	{
+		_tnr_prime(t, in);
+	}
+	
+	/* Each field / colour combination has its own position in the history */
+	plane = ((row % step) * 4 + __builtin_ctz(mask | 0x80000000) / 8) % TNR_PLANES;
+	
+	for(y = row; y < t->rows; y += step)
+	{
+		if(t->mode == TNR_STACK)
+		{
+			hist = t->history + t->pos[plane] * t->len;
+			_stack_row(t, t->acc + y * t->stride, hist + y * t->stride, in + y * t->stride, mask);
+		}
+		else
+		{
+			_recursive_row(t, t->acc + y * t->stride, in + y * t->stride, mask);
+		}
+	}
+	
+	if(t->mode == TNR_STACK)
+	{
+		t->pos[plane] = (t->pos[plane] + 1) % t->frames;
+		_stack_render(t, t->back);
+	}
+	else
+	{
+		_recursive_render(t, t->back);
+	}
+}
+
+static void *_tnr_thread(void *arg)
+{
+	tnr_t *t = arg;
+	uint8_t *p;
+	int row, step;
+	uint32_t mask;
+	
+	pthread_mutex_lock(&t->mutex);
+	
+	while(1)
+	{
+		while(!t->pending && !t->quit)
+		{
+			pthread_cond_wait(&t->cond, &t->mutex);
+		}
+		
+		if(t->quit) break;
+		
+		/* Take the pending frame */
+		p = t->work;
+		t->work = t->in;
+		t->in = p;
+		row = t->row;
+		step = t->step;
+		mask = t->mask;
+		t->pending = 0;
+		
+		pthread_mutex_unlock(&t->mutex);
+		
+		_tnr_process(t, t->work, row, step, mask);
+		
+		pthread_mutex_lock(&t->mutex);
+		
+		/* Publish the result */
+		p = t->ready;
+		t->ready = t->back;
+		t->back = p;
+		t->fresh = 1;
+	}
+	
+	pthread_mutex_unlock(&t->mutex);
+	
+	return(NULL);
+}
+
+void tnr_free(tnr_t *t)
+{
+	if(t->thread)
+	{
+		pthread_mutex_lock(&t->mutex);
+		t->quit = 1;
+		pthread_cond_signal(&t->cond);
+		pthread_mutex_unlock(&t->mutex);
+		
+		pthread_join(t->thread, NULL);
+		
+		pthread_cond_destroy(&t->cond);
+		pthread_mutex_destroy(&t->mutex);
+	}
+	
+	free(t->acc);
+	free(t->history);
+	free(t->in);
+	free(t->work);
+	free(t->front);
+	free(t->ready);
+	free(t->back);
+	
+	memset(t, 0, sizeof(tnr_t));
+}
+
+int tnr_init(tnr_t *t, int stride, int rows, int mode, int frames)
+{
+	memset(t, 0, sizeof(tnr_t));
+	
+	if(frames < 1) frames = 1;
+	if(frames > 255) frames = 255;
+	
+	t->mode = mode;
+	t->frames = frames;
+	t->stride = stride;
+	t->rows = rows;
+	t->len = stride * rows;
+	
+	t->acc = calloc(t->len, sizeof(uint16_t));
+	t->in = malloc(t->len);
+	t->work = malloc(t->len);
+	t->front = calloc(t->len, 1);
+	t->ready = calloc(t->len, 1);
+	t->back = calloc(t->len, 1);
+	
+	if(mode == TNR_STACK)
+	{
+		t->history = malloc(t->len * frames);
+	}
+	
+	if(!t->acc || !t->in || !t->work || !t->front || !t->ready || !t->back ||
+	   (mode == TNR_STACK && !t->history))
+	{
+		perror("malloc");
+		tnr_free(t);
+		return(-1);
+	}
+	
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	
+	if(pthread_create(&t->thread, NULL, _tnr_thread, (void *) t) != 0)
+	{
+		perror("pthread_create");
+		t->thread = 0;
+		pthread_cond_destroy(&t->cond);
+		pthread_mutex_destroy(&t->mutex);
+		tnr_free(t);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+void tnr_push(tnr_t *t, const void *frame, int row, int step, uint32_t mask)
+{
+	pthread_mutex_lock(&t->mutex);
+	
+	/* An unprocessed frame is replaced, the decoder never waits */
+	memcpy(t->in, frame, t->len);
+	t->row = row;
+	t->step = step;
+	t->mask = mask;
+	t->pending = 1;
+	
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+}
+
+const void *tnr_output(tnr_t *t)
+{
+	uint8_t *p;
+	
+	pthread_mutex_lock(&t->mutex);
+	
+	if(t->fresh)
+	{
+		p = t->front;
+		t->front = t->ready;
+		t->ready = p;
+		t->fresh = 0;
+	}
+	
+	pthread_mutex_unlock(&t->mutex);
+	
+	return(t->front);
+}
+
@@ -0,0 +1,74 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _TNR_H
+#define _TNR_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Temporal noise reduction. Frames are filtered on a worker thread,
+ * the result is available one submission later */
+
+#define TNR_RECURSIVE 0
+#define TNR_STACK     1
+
+#define TNR_PLANES 8
+
+typedef struct {
+	
+	int mode;
+	int frames;
+	
+	int stride;
+	int rows;
+	int len;
+	
+	/* Filter state */
+	int primed;
+	uint16_t *acc;
+	uint8_t *history;
+	int pos[TNR_PLANES];
+	
+	/* Input and the copy being worked on */
+	uint8_t *in;
+	uint8_t *work;
+	int pending;
+	int row;
+	int step;
+	uint32_t mask;
+	
+	/* Triple-buffered output */
+	uint8_t *front;
+	uint8_t *ready;
+	uint8_t *back;
+	int fresh;
+	
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+	
+} tnr_t;
+
+extern int tnr_init(tnr_t *t, int stride, int rows, int mode, int frames);
+extern void tnr_free(tnr_t *t);
+extern void tnr_push(tnr_t *t, const void *frame, int row, int step, uint32_t mask);
+extern const void *tnr_output(tnr_t *t);
+
+#endif
+
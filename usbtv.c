@@ -0,0 +1,1154 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "usbtv.h"
+
+/* Frames without a vsync before the signal is reacquired */
+#define _VSYNC_TIMEOUT 2
+
+/* Helpers for the line decoder are always inlined, so each
+ * specialised kernel sees its geometry as constants */
+#define _INLINE static inline __attribute__ ((always_inline))
+
+static void _select_kernel(usbtv_t *s);
+
+/* Unified S-Band TV Decoder */
+void usbtv_free(usbtv_t *s)
+{
+	free(s->framebuffer);
+	free(s->hsum);
+	free(s->hprof);
+	free(s->iline);
+	free(s->acq);
+}
+
+int usbtv_init(usbtv_t *s, uint32_t sample_rate, int colour)
+{
+	memset(s, 0, sizeof(usbtv_t));
+	
+	s->sample_rate = sample_rate;
+	s->colour = colour != 0;
+	
+	if(s->colour)
+	{
+		/* 525 line 30/1.001 fps interlaced field-sequential colour */
+		s->lines = 525;
+		s->active_lines = 480;
+		s->frame_rate_num = 30000;
+		s->frame_rate_den =  1001;
+		
+		s->hsync_width  = round(s->sample_rate * 0.00000470); /* 4.70 ±1.00µs */
+		s->vsync_width  = round(s->sample_rate * 0.00002710); /* 27.10 µs */
+		
+		s->active_left  = round(s->sample_rate * 0.00000920); /* |-->| 9.20µs */
+		s->active_width = ceil(s->sample_rate *  0.00005290); /* 52.90µs */
+		
+		s->fsc_left  = round(s->sample_rate * 0.00001470); /* |-->| 14.70µs */
+		s->fsc_width = round(s->sample_rate * 0.00002000); /* 20.00µs */
+	}
+	else
+	{
+		/* 320 line 10 fps progressive mono */
+		s->lines = 320;
+		s->active_lines = 312;
+		s->frame_rate_num = 10;
+		s->frame_rate_den = 1;
+		
+		s->hsync_width  = round(s->sample_rate * 0.00002000); /* 20.00µs */
+		s->vsync_width  = round(s->sample_rate * 0.00026750); /* 267.5µs */
+		
+		s->active_left  = round(s->sample_rate * 0.00002500); /* |-->| 25.0µs */
+		s->active_width = ceil(s->sample_rate * 0.00028250); /* 282.5µs */
+	}
+	
+	s->width = round((double) s->sample_rate / s->lines / ((double) s->frame_rate_num / s->frame_rate_den));
+	
+	if(s->active_width > s->width)
+	{
+		s->active_width = s->width;
+	}
+	
+	s->iline_len = 0;
+	s->iline = malloc(s->width * sizeof(int16_t));
+	if(!s->iline)
+	{
+		perror("malloc");
+		usbtv_free(s);
+		return(-1);
+	}
+	
+	s->hsum = malloc((s->width + s->hsync_width + 1) * sizeof(int32_t));
+	s->hprof = calloc(s->width, sizeof(float));
+	if(!s->hsum || !s->hprof)
+	{
+		perror("calloc");
+		usbtv_free(s);
+		return(-1);
+	}
+	
+	/* Mono frames are stored as luma only, and expanded by the display */
+	s->bytes_per_pixel = (s->colour ? sizeof(uint32_t) : sizeof(uint8_t));
+	s->framebuffer_len = s->active_width * s->active_lines * s->bytes_per_pixel;
+	s->framebuffer = malloc(s->framebuffer_len);
+	if(!s->framebuffer)
+	{
+		perror("malloc");
+		usbtv_free(s);
+		return(-1);
+	}
+	
+	/* Enough for a full frame, plus room for the hsync phase and vsync window */
+	s->acq_size = (double) s->sample_rate * s->frame_rate_den / s->frame_rate_num * (s->lines + 1) / s->lines;
+	s->acq_size += s->width + s->vsync_width;
+	s->acq = malloc(s->acq_size * sizeof(int16_t));
+	if(!s->acq)
+	{
+		perror("malloc");
+		usbtv_free(s);
+		return(-1);
+	}
+	
+	s->frame = 1;
+	s->line = 1;
+	s->fsc = 0;
+	s->fsc_hold = 0;
+	s->skip = 0;
+	s->decimate = 1;
+	s->dirty_first = s->active_lines;
+	s->dirty_last = -1;
+	s->frame_start = 1;
+	
+	_select_kernel(s);
+	usbtv_acquire(s);
+	
+	return(0);
+}
+
+static void _update_levels(usbtv_t *s)
+{
+	s->blank_level = s->sync_level + (INT16_MAX * 0.3);
+	
+	/* Calculate the black and white levels */
+	if(s->colour)
+	{
+		s->black_level = s->sync_level + (INT16_MAX * 0.3525);
+	}
+	else
+	{
+		s->black_level = s->sync_level + (INT16_MAX * 0.3);
+	}
+	
+	s->white_level = s->sync_level + (INT16_MAX * 1.0);
+}
+
+_INLINE int _vsync_template(int colour, int half)
+{
+	int l = half / 2 + 1;
+	
+	/* Returns 1 for half-lines with a vsync pulse, -1 for those
+	 * nearby without one and 0 for everything else. These are
+	 * the same patterns matched by the tracking vsync detector */
+	
+	if(colour)
+	{
+		if(half >= 6 && half < 12) return(1);          /* Lines 4-6 */
+		if(half >= 531 && half < 537) return(1);       /* Lines 266b-269a */
+		if(half < 18 || (half >= 519 && half < 549)) return(-1);
+	}
+	else
+	{
+		if(l <= 8) return(1);
+		if(l <= 14 || l > 320 - 6) return(-1);
+	}
+	
+	return(0);
+}
+
+_INLINE int _vsync_weight(int colour, int k)
+{
+	int n = (colour ? 525 * 2 : 320);
+	
+	/* The template by half-line in colour mode, or by line in mono */
+	k = (k % n + n) % n;
+	
+	return(_vsync_template(colour, colour ? k : k * 2));
+}
+
+_INLINE float _vsync_level(usbtv_t *s, const int16_t *p, int vsync_width)
+{
+	float v;
+	int x, sum;
+	
+	/* The mean of the vsync window, 1.0 at the sync level and 0.0 at
+	 * the measured back porch level. Near the FM threshold the sync
+	 * depth is compressed, so the nominal blanking level is too high */
+	if(s->porch_level - s->sync_level < 1) return(0);
+	
+	for(sum = 0, x = 0; x < vsync_width; x++)
+	{
+		sum += p[x];
+	}
+	
+	v = (s->porch_level - (float) sum / vsync_width) / (s->porch_level - s->sync_level);
+	
+	return(v > 1.0 ? 1.0 : (v < 0.0 ? 0.0 : v));
+}
+
+_INLINE float _vsync_match(usbtv_t *s, int colour, int end, int len)
+{
+	float p, m;
+	int np, nm;
+	int i, t;
+	
+	/* Match the recent history against the template, from k = end
+	 * back. Scores 1.0 for a perfect match, 0.0 or less for none */
+	p = m = 0;
+	np = nm = 0;
+	
+	for(i = 0; i < len; i++)
+	{
+		t = _vsync_weight(colour, end - i);
+		
+		if(t > 0)
+		{
+			p += s->vhist[i];
+			np++;
+		}
+		else if(t < 0)
+		{
+			m += s->vhist[i];
+			nm++;
+		}
+	}
+	
+	return(p / np - m / nm);
+}
+
+static int _vsync_detect(usbtv_t *s, const float *score, int n)
+{
+	float v;
+	int i, j, r;
+	
+	/* Returns the pattern with a peak over 0.5 on the previous line,
+	 * or -1. It also has to beat the other patterns' scores either
+	 * side, as the colour fields only differ by half-line phase */
+	for(r = -1, i = 0; i < n; i++)
+	{
+		v = s->vscore[i][0];
+		if(v <= 0.5 || v < s->vscore[i][1] || v <= score[i]) continue;
+		
+		for(j = 0; j < n; j++)
+		{
+			if(j == i) continue;
+			if(v <= score[j] || v <= s->vscore[j][0] || v <= s->vscore[j][1]) break;
+		}
+		
+		if(j == n) r = i;
+	}
+	
+	for(i = 0; i < n; i++)
+	{
+		s->vscore[i][1] = s->vscore[i][0];
+		s->vscore[i][0] = score[i];
+	}
+	
+	return(r);
+}
+
+_INLINE int _vsync_line(usbtv_t *s, int colour)
+{
+	/* Lines with vsync or equalising pulses, where the pulse at
+	 * the start of the line is not a normal hsync */
+	if(colour)
+	{
+		return(s->line <= 9 || (s->line >= 263 && s->line <= 272));
+	}
+	
+	return(s->line <= 8);
+}
+
+typedef float   _v8f   __attribute__ ((vector_size (32)));
+typedef int32_t _v8i32 __attribute__ ((vector_size (32)));
+
+_INLINE int _hsync_match(usbtv_t *s, const int n, const int w)
+{
+	int32_t *sum = s->hsum;
+	_v8i32 a, b;
+	_v8f r, p;
+	float mx, e;
+	int x, px;
+	
+	/* Prefix sums, wrapping around the end of the line so pulses
+	 * starting near it are whole. The previous line's front porch
+	 * is stood in for by the end of this one */
+	sum[0] = 0;
+	for(x = 0; x < n; x++)
+	{
+		sum[x + 1] = sum[x] + s->iline[x];
+	}
+	
+	for(; x < n + w; x++)
+	{
+		sum[x + 1] = sum[x] + s->iline[x - n];
+	}
+	
+	/* For a flat pulse in white noise the matched filter is a box
+	 * the width of the pulse. Profile position x is a pulse starting
+	 * at x, negated so the best match is the peak. The profile is
+	 * averaged over lines, as the phase changes slowly */
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		memcpy(&a, sum + x, sizeof(a));
+		memcpy(&b, sum + x + w, sizeof(b));
+		
+		r = __builtin_convertvector(a - b, _v8f);
+		
+		memcpy(&p, s->hprof + x, sizeof(p));
+		p += (r - p) * 0.25f;
+		memcpy(s->hprof + x, &p, sizeof(p));
+	}
+	
+	for(; x < n; x++)
+	{
+		s->hprof[x] += ((sum[x] - sum[x + w]) - s->hprof[x]) * 0.25f;
+	}
+	
+	for(mx = s->hprof[0], px = 0, x = 1; x < n; x++)
+	{
+		if(s->hprof[x] > mx)
+		{
+			mx = s->hprof[x];
+			px = x;
+		}
+	}
+	
+	/* Confidence is the sharpness of the peak. A box half off a
+	 * pulse of nominal depth loses w / 2 times that depth */
+	e = mx - s->hprof[(px + w / 2) % n];
+	mx = mx - s->hprof[(px + n - w / 2) % n];
+	if(e < mx) mx = e;
+	
+	mx /= (w > 1 ? w / 2 : 1) * (INT16_MAX * 0.3);
+	s->info.hsync_confidence = (mx > 1.0 ? 1.0 : (mx < 0.0 ? 0.0 : mx));
+	
+	/* The pulse offset from the start of the line */
+	if(px >= n / 2) px -= n;
+	
+	return(px);
+}
+
+_INLINE void _hsync_shift(usbtv_t *s, int d, const int n)
+{
+	float t;
+	
+	/* Keep the profile aligned with the next line, which
+	 * the hsync correction will shift by -d samples */
+	if(d < 0)
+	{
+		t = s->hprof[n - 1];
+		memmove(s->hprof + 1, s->hprof, (n - 1) * sizeof(float));
+		s->hprof[0] = t;
+	}
+	else if(d > 0)
+	{
+		t = s->hprof[0];
+		memmove(s->hprof, s->hprof + 1, (n - 1) * sizeof(float));
+		s->hprof[n - 1] = t;
+	}
+}
+
+static int _acquire(usbtv_t *s)
+{
+	double period;
+	int64_t *fold;
+	float *v;
+	int halves;
+	int i, k, x, n;
+	int64_t sum, best;
+	int phase;
+	double score, best_score;
+	int offset;
+	
+	/* Find the hsync phase. Fold the buffer at the exact line period
+	 * and look for the lowest box sum the width of the sync pulse.
+	 * Noise averages out in the fold, so this works at low SNR */
+	period = (double) s->sample_rate * s->frame_rate_den / s->frame_rate_num / s->lines;
+	
+	fold = calloc(s->width, sizeof(int64_t));
+	v = malloc(s->lines * 2 * sizeof(float));
+	if(!fold || !v)
+	{
+		perror("malloc");
+		free(fold);
+		free(v);
+		return(-1);
+	}
+	
+	for(k = 0; k < s->lines; k++)
+	{
+		n = lround(k * period);
+		
+		for(x = 0; x < s->width; x++)
+		{
+			fold[x] += s->acq[n + x];
+		}
+	}
+	
+	for(sum = 0, x = 0; x < s->hsync_width; x++)
+	{
+		sum += fold[x];
+	}
+	
+	best = sum;
+	phase = 0;
+	
+	for(x = 1; x < s->width; x++)
+	{
+		sum += fold[(x + s->hsync_width - 1) % s->width] - fold[x - 1];
+		
+		if(sum < best)
+		{
+			best = sum;
+			phase = x;
+		}
+	}
+	
+	/* The sync level is the mean of the pulse, the porch level the
+	 * mean between the pulse and the active picture */
+	s->sync_level = best / s->lines / s->hsync_width;
+	s->porch_level = s->sync_level;
+	_update_levels(s);
+	
+	n = s->active_left - s->hsync_width - 2;
+	if(n > 0)
+	{
+		for(sum = 0, x = s->hsync_width + 1; x < s->active_left - 1; x++)
+		{
+			sum += fold[(phase + x) % s->width];
+		}
+		
+		s->porch_level = sum / s->lines / n;
+	}
+	
+	/* Without a signal the fold is flat, a real
+	 * pulse is well below the line's average */
+	for(sum = 0, x = 0; x < s->width; x++)
+	{
+		sum += fold[x];
+	}
+	
+	free(fold);
+	
+	if(sum / s->lines / s->width - s->sync_level < (s->blank_level - s->sync_level) / 2)
+	{
+		free(v);
+		return(0);
+	}
+	
+	/* Measure the vsync window at the start of each line, and of
+	 * each half-line in colour mode. As the picture is clipped the
+	 * correlation only depends on where sync pulses are, and aren't */
+	halves = (s->colour ? 2 : 1);
+	
+	for(k = 0; k < s->lines * halves; k++)
+	{
+		v[k] = _vsync_level(s, s->acq + phase + lround(k * period / halves), s->vsync_width);
+	}
+	
+	/* Correlate against the vsync pattern to find the line number of
+	 * the first buffered line. The template is in half-lines for the
+	 * colour mode, where each line has two entries */
+	best_score = -1e9;
+	offset = 0;
+	
+	for(i = 0; i < s->lines; i++)
+	{
+		score = 0;
+		
+		for(k = 0; k < s->lines * halves; k++)
+		{
+			score += v[k] * _vsync_weight(s->colour, i * halves + k);
+		}
+		
+		if(score > best_score)
+		{
+			best_score = score;
+			offset = i;
+		}
+	}
+	
+	/* The best match still has to look like a vsync. Require the
+	 * pulses be nearer the sync level than blanking on average */
+	score = 0;
+	n = 0;
+	
+	for(k = 0; k < s->lines * halves; k++)
+	{
+		if(_vsync_weight(s->colour, offset * halves + k) > 0)
+		{
+			score += v[k];
+			n++;
+		}
+	}
+	
+	free(v);
+	
+	if(score < n * 0.5)
+	{
+		/* Not enough of a match. Maybe there's no signal yet */
+		return(0);
+	}
+	
+	s->line = offset + 1;
+	s->vsync_count = s->lines * _VSYNC_TIMEOUT;
+	
+	/* Restart the sync tracking at the found phase */
+	s->iline_len = 0;
+	s->hsync_offset = 0;
+	memset(s->hprof, 0, s->width * sizeof(float));
+	memset(s->vhist, 0, sizeof(s->vhist));
+	memset(s->vscore, 0, sizeof(s->vscore));
+	
+	/* Replay the buffer from the start of the first line */
+	s->acq_pos = phase;
+	
+	return(1);
+}
+
+void usbtv_acquire(usbtv_t *s)
+{
+	/* Blanking still due for dropped input would be inserted after
+	 * the acquired frame, out of order. Skip over it instead */
+	s->in_pos += s->gap;
+	s->stat_dropped += s->gap;
+	s->gap = 0;
+	
+	s->acquire = 1;
+	s->acq_len = 0;
+	s->acq_pos = -1;
+}
+
+_INLINE int _decode_line(usbtv_t *s, const int colour, const int width, const int hsync_width, const int vsync_width, const int active_left, const int active_width, const int fsc_left, const int fsc_width)
+{
+	const int lines = (colour ? 525 : 320);
+	const int active_lines = (colour ? 480 : 312);
+	const int16_t *src;
+	float scale;
+	int aline;
+	int step;
+	int x, i;
+	int mx;
+	int ref;
+	int64_t sq;
+	int64_t end;
+	float score[2];
+	
+	/* The input index following the line, less anything still to replay */
+	end = s->in_pos - (s->acq_pos >= 0 ? s->acq_len - s->acq_pos : 0);
+	
+	/* Find hsync with the matched filter, and step towards it. This
+	 * holds through the vsync, where the pulses would mislead it, and
+	 * through lines filled in for dropped input, which have no pulse */
+	if(!s->gap_line) s->stat_lines++;
+	
+	if(s->gap_line || _vsync_line(s, colour))
+	{
+		ref = 0;
+		s->info.hsync_confidence = 0;
+	}
+	else
+	{
+		ref = _hsync_match(s, width, hsync_width);
+		
+		/* Lock statistics, for lines with a normal hsync */
+		s->stat_hlines++;
+		if(ref >= -1 && ref <= 1) s->stat_hlock++;
+	}
+	
+	if(ref < 0) s->hsync_offset--;
+	if(ref > 0) s->hsync_offset++;
+	
+	_hsync_shift(s, ref, width);
+	
+	/* Update the sync level */
+	ref = s->iline[1];
+	sq = (int64_t) ref * ref;
+	for(x = 2; x < hsync_width - 1; x++)
+	{
+		ref += s->iline[x];
+		sq += s->iline[x] * s->iline[x];
+	}
+	ref /= hsync_width - 2;
+	
+	/* Measure the sync depth against the back porch, and the noise on the tip */
+	mx = active_left - hsync_width - 2;
+	s->info.sync_depth = 0;
+	
+	if(mx > 0)
+	{
+		for(x = hsync_width + 1; x < active_left - 1; x++)
+		{
+			s->info.sync_depth += s->iline[x];
+		}
+		
+		s->info.sync_depth = s->info.sync_depth / mx - ref;
+		
+		/* The porch is sync on broad pulse lines */
+		if(!_vsync_line(s, colour) && !s->gap_line)
+		{
+			s->porch_level = (s->porch_level * 99 + s->info.sync_depth + ref) / 100;
+		}
+	}
+	
+	sq = sq / (hsync_width - 2) - (int64_t) ref * ref;
+	s->info.noise = (sq > 0 ? sqrt(sq) : 0);
+	
+	if(!s->gap_line)
+	{
+		s->sync_level = (s->sync_level * 99 + ref) / 100;
+		_update_levels(s);
+	}
+	
+	/* Scan for vsync. Each pattern is matched up to the end of its
+	 * last pulse, and the line number set one line after the best match */
+	memmove(s->vhist + 1, s->vhist, (USBTV_VSYNC_HIST - 1) * sizeof(float));
+	s->vhist[0] = (s->gap_line ? 0 : _vsync_level(s, s->iline, vsync_width));
+	
+	if(colour)
+	{
+		memmove(s->vhist + 1, s->vhist, (USBTV_VSYNC_HIST - 1) * sizeof(float));
+		s->vhist[0] = (s->gap_line ? 0 : _vsync_level(s, s->iline + width / 2, vsync_width));
+	}
+	
+	if(s->gap_line)
+	{
+		/* The line number runs on through a gap. A partial
+		 * pattern could look like a vsync, so don't look */
+		memset(s->vscore, 0, sizeof(s->vscore));
+		s->info.vsync_confidence = 0;
+		aline = 0;
+	}
+	else if(colour)
+	{
+		/* Field 1, ending at line 7, and field 2, ending at 269 */
+		score[0] = _vsync_match(s, colour, 13, 14);
+		score[1] = _vsync_match(s, colour, 537, 19);
+		
+		x = _vsync_detect(s, score, 2);
+		aline = (x == 0 ? 8 : (x == 1 ? 270 : 0));
+		
+		s->info.vsync_confidence = (score[0] > score[1] ? score[0] : score[1]);
+	}
+	else
+	{
+		/* Ending at line 9 */
+		score[0] = _vsync_match(s, colour, 8, 15);
+		aline = (_vsync_detect(s, score, 1) == 0 ? 10 : 0);
+		
+		s->info.vsync_confidence = score[0];
+	}
+	
+	if(s->info.vsync_confidence < 0) s->info.vsync_confidence = 0;
+	
+	if(aline)
+	{
+		/* A vsync where one was expected */
+		if(s->line == aline) s->stat_vsync++;
+		
+		s->line = aline;
+		s->vsync_count = lines * _VSYNC_TIMEOUT;
+	}
+	
+	s->vsync_count += (s->vsync_count ? -1 : 0);
+	
+	/* Lost vertical lock, start over with a fresh acquisition */
+	if(s->vsync_count == 0)
+	{
+		usbtv_acquire(s);
+	}
+	
+	/* Update FSC counter */
+	if(colour)
+	{
+		if(s->line == 1 || s->line == 264)
+		{
+			s->fsc++;
+			s->fsc %= 3;
+			if(s->fsc == 1) s->fsc_hold = 0;
+		}
+		
+		/* Detect the FSC flag. The hold function forces at
+		 * at least one full cycle between each FSC reset. */
+		
+		if(!s->fsc_hold && (s->line == 18 || s->line == 281))
+		{
+			ref = 0;
+			
+			for(x = fsc_left; x < fsc_left + fsc_width; x++)
+			{
+				ref += s->iline[x];
+			}
+			
+			ref /= fsc_width;
+			
+			if(ref > (s->white_level + s->black_level) / 2)
+			{
+				s->fsc = 1;
+				s->fsc_hold = 1;
+			}
+		}
+		
+		aline = (s->line < 265 ? (s->line - 23) * 2 : (s->line - 286) * 2 + 1);
+	}
+	else
+	{
+		aline = s->line - 9;
+	}
+	
+	if(!s->skip && aline >= 0 && aline < active_lines)
+	{
+		src = s->iline + active_left;
+		
+		/* A multiply rather than a divide per pixel, so the loops vectorise */
+		scale = 255.0f / (s->white_level - s->black_level);
+		step = s->decimate;
+		
+		if(colour)
+		{
+			uint32_t *dst = (uint32_t *) s->framebuffer + aline * active_width;
+			const int shift = s->fsc * 8;
+			
+			if(step > 1)
+			{
+				/* Decimated, compute one pixel in step and repeat it */
+				for(x = 0; x < active_width; x += step)
+				{
+					int v = (src[x] - s->black_level) * scale;
+					v = (v > 0xFF ? 0xFF : (v < 0x00 ? 0x00 : v));
+					
+					for(i = x; i < x + step && i < active_width; i++)
+					{
+						dst[i] = (dst[i] & ~(0xFF << shift)) | v << shift;
+					}
+				}
+			}
+			else
+			{
+				for(x = 0; x < active_width; x++)
+				{
+					int v = (src[x] - s->black_level) * scale;
+					v = (v > 0xFF ? 0xFF : (v < 0x00 ? 0x00 : v));
+					
+					dst[x] = (dst[x] & ~(0xFF << shift)) | v << shift;
+				}
+			}
+		}
+		else
+		{
+			uint8_t *dst = s->framebuffer + aline * active_width;
+			
+			if(step > 1)
+			{
+				for(x = 0; x < active_width; x += step)
+				{
+					int v = (src[x] - s->black_level) * scale;
+					v = (v > 0xFF ? 0xFF : (v < 0x00 ? 0x00 : v));
+					
+					for(i = x; i < x + step && i < active_width; i++)
+					{
+						dst[i] = v;
+					}
+				}
+			}
+			else
+			{
+				for(x = 0; x < active_width; x++)
+				{
+					int v = (src[x] - s->black_level) * scale;
+					dst[x] = (v > 0xFF ? 0xFF : (v < 0x00 ? 0x00 : v));
+				}
+			}
+		}
+		
+		if(aline < s->dirty_first) s->dirty_first = aline;
+		if(aline > s->dirty_last) s->dirty_last = aline;
+	}
+	
+	/* Record the line metadata */
+	s->info.frame = s->frame;
+	s->info.line = s->line;
+	s->info.active_line = (aline >= 0 && aline < active_lines ? aline : -1);
+	s->info.field = (colour ? (s->line < 264 ? 1 : 2) : 0);
+	s->info.fsc = s->fsc;
+	s->info.hsync_offset = s->hsync_offset;
+	s->info.sync_level = s->sync_level;
+	s->info.black_level = s->black_level;
+	s->info.white_level = s->white_level;
+	s->info.samples = s->iline;
+	s->info.width = width;
+	s->info.sample = end - width;
+	s->info.gap = s->gap_line;
+	s->gap_line = 0;
+	
+	if(s->frame_start)
+	{
+		s->frame_first = s->info.sample;
+		s->frame_start = 0;
+	}
+	
+	s->line++;
+	
+	if(s->line > lines)
+	{
+		s->line = 1;
+		s->frame++;
+	}
+	
+	/* In colour mode, signal to update the frame each field */
+	if(s->line == 1 || (colour && s->line == 264))
+	{
+		s->frame_last = end - 1;
+		s->frame_start = 1;
+		
+		return(1);
+	}
+	
+	return(0);
+}
+
+/* The line decoder kernels. The generic ones read the geometry from
+ * the decoder state, the others have it fixed for a sample rate */
+static int _decode_mono(usbtv_t *s)
+{
+	return(_decode_line(s, 0, s->width, s->hsync_width, s->vsync_width, s->active_left, s->active_width, 0, 0));
+}
+
+static int _decode_colour(usbtv_t *s)
+{
+	return(_decode_line(s, 1, s->width, s->hsync_width, s->vsync_width, s->active_left, s->active_width, s->fsc_left, s->fsc_width));
+}
+
+/* Geometries with a specialised kernel, as the arguments of _decode_line()
+ * from colour to fsc_width. These are the standards at 2.25 MHz */
+#define _MONO_2250   0, 703, 45, 602, 56, 636,  0,  0
+#define _COLOUR_2250 1, 143, 11,  61, 21, 120, 33, 45
+
+static int _decode_mono_2250(usbtv_t *s)
+{
+	return(_decode_line(s, _MONO_2250));
+}
+
+static int _decode_colour_2250(usbtv_t *s)
+{
+	return(_decode_line(s, _COLOUR_2250));
+}
+
+static const struct {
+	int colour;
+	int width;
+	int hsync_width;
+	int vsync_width;
+	int active_left;
+	int active_width;
+	int fsc_left;
+	int fsc_width;
+	int (*decode)(usbtv_t *s);
+} _kernels[] = {
+	{ _MONO_2250,   _decode_mono_2250 },
+	{ _COLOUR_2250, _decode_colour_2250 },
+};
+
+static void _select_kernel(usbtv_t *s)
+{
+	int i;
+	
+	s->decode = (s->colour ? _decode_colour : _decode_mono);
+	
+	/* Use a specialised kernel if one matches the whole geometry */
+	for(i = 0; i < (int) (sizeof(_kernels) / sizeof(_kernels[0])); i++)
+	{
+		if(_kernels[i].colour == s->colour &&
+		   _kernels[i].width == s->width &&
+		   _kernels[i].hsync_width == s->hsync_width &&
+		   _kernels[i].vsync_width == s->vsync_width &&
+		   _kernels[i].active_left == s->active_left &&
+		   _kernels[i].active_width == s->active_width &&
+		   _kernels[i].fsc_left == s->fsc_left &&
+		   _kernels[i].fsc_width == s->fsc_width)
+		{
+			s->decode = _kernels[i].decode;
+		}
+	}
+}
+
+int usbtv_read(usbtv_t *s)
+{
+	int x;
+	
+	while(s->acquire)
+	{
+		/* Blanking still due for dropped input goes in first,
+		 * keeping the buffer in time order */
+		x = s->acq_size - s->acq_len;
+		if(x > s->gap) x = s->gap;
+		
+		s->gap -= x;
+		s->in_pos += x;
+		while(x--) s->acq[s->acq_len++] = s->blank_level;
+		
+		/* Collect a frame's worth of samples */
+		x = s->acq_size - s->acq_len;
+		if(x > s->in_len) x = s->in_len;
+		
+		memcpy(s->acq + s->acq_len, s->in, x * sizeof(int16_t));
+		s->acq_len += x;
+		s->in += x;
+		s->in_len -= x;
+		s->in_pos += x;
+		
+		if(s->acq_len < s->acq_size) return(2);
+		
+		x = _acquire(s);
+		if(x < 0) return(x);
+		
+		if(x == 0)
+		{
+			/* Try again, keeping the second half of the buffer */
+			s->acq_len /= 2;
+			memmove(s->acq, s->acq + s->acq_len, (s->acq_size - s->acq_len) * sizeof(int16_t));
+			s->acq_len = s->acq_size - s->acq_len;
+			continue;
+		}
+		
+		s->acquire = 0;
+	}
+	
+	while(s->iline_len < s->width)
+	{
+		if(s->hsync_offset < 0)
+		{
+			s->iline_len++;
+			s->hsync_offset++;
+			continue;
+		}
+		else if(s->iline_len > 0 && s->hsync_offset > 0)
+		{
+			s->iline_len--;
+			s->hsync_offset--;
+			continue;
+		}
+		
+		if(s->acq_pos >= 0)
+		{
+			/* Replaying the acquisition buffer */
+			s->iline[s->iline_len] = s->acq[s->acq_pos++];
+			if(s->acq_pos == s->acq_len) s->acq_pos = -1;
+		}
+		else if(s->gap > 0)
+		{
+			/* Blanking in place of dropped input */
+			s->iline[s->iline_len] = s->blank_level;
+			s->gap--;
+			s->in_pos++;
+			s->gap_line = 1;
+		}
+		else
+		{
+			if(s->in_len == 0) return(2);
+			
+			s->iline[s->iline_len] = *s->in;
+			
+			s->in++;
+			s->in_len--;
+			s->in_pos++;
+		}
+		
+		s->iline_len++;
+	}
+	
+	s->iline_len = 0;
+	
+	return(s->decode(s));
+}
+
+void usbtv_gap(usbtv_t *s, int64_t samples)
+{
+	int x;
+	
+	if(samples <= 0) return;
+	
+	if(s->acquire)
+	{
+		/* Fill the acquisition buffer first, so its timing is unbroken */
+		x = s->acq_size - s->acq_len;
+		if(x > samples) x = samples;
+		
+		while(x--)
+		{
+			s->acq[s->acq_len++] = s->blank_level;
+			s->in_pos++;
+			samples--;
+		}
+	}
+	
+	s->gap += samples;
+	
+	if(s->gap > s->acq_size)
+	{
+		/* Too long to run through, acquire the signal again */
+		usbtv_acquire(s);
+	}
+}
+
+int usbtv_write(usbtv_t *s, const int16_t *buf, int samples)
+{
+	s->in = buf;
+	s->in_len = samples;
+	
+	return(0);
+}
+
+double usbtv_lock_quality(const usbtv_t *s)
+{
+	double h, v;
+	int expected;
+	
+	/* The number of vsyncs there should have been. The
+	 * first can never be in phase and is not counted */
+	expected = s->stat_lines / s->lines * (s->colour ? 2 : 1) - 1;
+	if(expected < 1) return(0);
+	
+	h = (double) s->stat_hlock / (s->stat_hlines > 0 ? s->stat_hlines : 1);
+	v = (double) s->stat_vsync / expected;
+	
+	return(h * (v < 1.0 ? v : 1.0));
+}
+
+int usbtv_sync_only(usbtv_t *s, const int16_t *buf, int samples)
+{
+	float score[2];
+	int i;
+	
+	/* The same detector work as _decode_line(), on every line */
+	for(i = 0; i + s->width <= samples; i += s->width)
+	{
+		memcpy(s->iline, buf + i, s->width * sizeof(int16_t));
+		
+		_hsync_match(s, s->width, s->hsync_width);
+		
+		memmove(s->vhist + 1, s->vhist, (USBTV_VSYNC_HIST - 1) * sizeof(float));
+		s->vhist[0] = _vsync_level(s, s->iline, s->vsync_width);
+		
+		if(s->colour)
+		{
+			memmove(s->vhist + 1, s->vhist, (USBTV_VSYNC_HIST - 1) * sizeof(float));
+			s->vhist[0] = _vsync_level(s, s->iline + s->width / 2, s->vsync_width);
+			
+			score[0] = _vsync_match(s, 1, 13, 14);
+			score[1] = _vsync_match(s, 1, 537, 19);
+			_vsync_detect(s, score, 2);
+		}
+		else
+		{
+			score[0] = _vsync_match(s, 0, 8, 15);
+			_vsync_detect(s, score, 1);
+		}
+	}
+	
+	return(i / s->width);
+}
+
+void usbtv_frame_info(const usbtv_t *s, usbtv_frame_t *frame)
+{
+	frame->frame = s->info.frame;
+	frame->field = s->info.field;
+	frame->fsc = s->info.fsc;
+	
+	frame->framebuffer = s->framebuffer;
+	frame->bytes_per_pixel = s->bytes_per_pixel;
+	frame->width = s->active_width;
+	frame->height = s->active_lines;
+	frame->stride = s->active_width * s->bytes_per_pixel;
+	
+	/* Colour fields are interlaced, the first on the even rows */
+	frame->first_row = (frame->field == 2 ? 1 : 0);
+	frame->row_step = (s->colour ? 2 : 1);
+	
+	frame->first_sample = s->frame_first;
+	frame->last_sample = s->frame_last;
+}
+
+int usbtv_dirty(usbtv_t *s, int *first)
+{
+	int rows;
+	
+	if(s->dirty_last < s->dirty_first)
+	{
+		return(0);
+	}
+	
+	*first = s->dirty_first;
+	rows = s->dirty_last - s->dirty_first + 1;
+	
+	s->dirty_first = s->active_lines;
+	s->dirty_last = -1;
+	
+	return(rows);
+}
+
+void usbtv_set_callbacks(usbtv_t *s, usbtv_line_cb_t line_cb, usbtv_frame_cb_t frame_cb, void *user)
+{
+	s->line_cb = line_cb;
+	s->frame_cb = frame_cb;
+	s->user = user;
+}
+
+int usbtv_push(usbtv_t *s, const int16_t *buf, int samples)
+{
+	usbtv_frame_t frame;
+	int r;
+	
+	usbtv_write(s, buf, samples);
+	
+	while((r = usbtv_read(s)) != 2)
+	{
+		if(r < 0) return(r);
+		
+		if(s->line_cb)
+		{
+			s->line_cb(s->user, &s->info);
+		}
+		
+		if(r == 1 && s->frame_cb)
+		{
+			usbtv_frame_info(s, &frame);
+			s->frame_cb(s->user, &frame);
+		}
+	}
+	
+	/* Don't hold on to the caller's buffer */
+	s->in = NULL;
+	s->in_len = 0;
+	
+	return(0);
+}
+
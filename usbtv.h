@@ -0,0 +1,258 @@
+/* apollo-tv - Apollo Unified S-Band TV viewer                           */
+/*=======================================================================*/
+/* Copyright 2019 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _USBTV_H
+#define _USBTV_H
+
+#include <stdint.h>
+
+/* Unified S-Band TV decoder, part of libapollotv.
+ *
+ * Each usbtv_t is independent and holds no global state, so separate
+ * instances may be used from different threads. An instance itself is
+ * not thread-safe.
+ *
+ * Input is FM demodulated samples (see fm.h). Sample buffers are
+ * borrowed and never retained beyond the current call. Samples are
+ * copied into the decoder a line at a time as they are decoded, and
+ * while acquiring (at startup and when lock is lost) a whole frame
+ * of input is copied into the acquisition buffer and replayed.
+*/
+
+/* Metadata for the most recently decoded line */
+typedef struct {
+	
+	int frame;              /* Frame counter */
+	int line;               /* Line number, 1 to lines */
+	int active_line;        /* Framebuffer row, or -1 outside the active area */
+	int field;              /* 1 or 2 in colour mode, 0 in mono */
+	int fsc;                /* Colour (framebuffer byte) of this field */
+	
+	int hsync_offset;       /* Current hsync correction in samples */
+	int sync_level;
+	int black_level;
+	int white_level;
+	
+	/* Signal quality. The measured depth of this line's sync
+	 * pulse below the back porch, and the RMS noise on its tip */
+	int sync_depth;
+	int noise;
+	
+	/* Confidence in the sync, 0.0 to 1.0. The hsync confidence is 0
+	 * on vsync and equalising lines, and lines with dropped input,
+	 * where hsync is held rather than measured */
+	float hsync_confidence;
+	float vsync_confidence;
+	
+	const int16_t *samples; /* The line's samples, valid until the next read */
+	int width;
+	int64_t sample;         /* Input index of the line's first sample */
+	int gap;                /* Part of the line was filled in for dropped input */
+	
+} usbtv_line_t;
+
+/* A completed frame, or field in colour mode */
+typedef struct {
+	
+	int frame;
+	int field;              /* 1 or 2 in colour mode, 0 in mono */
+	int fsc;
+	
+	/* One byte of luma per pixel in mono, ARGB8888 in colour */
+	const uint8_t *framebuffer;
+	int bytes_per_pixel;
+	int width;
+	int height;
+	int stride;             /* In bytes */
+	
+	/* Rows updated by this field are first_row, first_row + row_step ... */
+	int first_row;
+	int row_step;
+	
+	/* Input index of the first sample of the first line,
+	 * and of the last sample of the last line */
+	int64_t first_sample;
+	int64_t last_sample;
+	
+} usbtv_frame_t;
+
+/* The nominal sync level of the demodulated signal, for
+ * a transmitter and receiver with the same deviation */
+#define USBTV_SYNC_LEVEL (-INT16_MAX / 2)
+
+/* Lines, or colour half-lines, of vsync history */
+#define USBTV_VSYNC_HIST 32
+
+typedef void (*usbtv_line_cb_t)(void *user, const usbtv_line_t *line);
+typedef void (*usbtv_frame_cb_t)(void *user, const usbtv_frame_t *frame);
+
+typedef struct _usbtv_t {
+	
+	uint32_t sample_rate;
+	
+	int colour;
+	
+	int lines;
+	int active_lines;
+	
+	int width;
+	
+	int hsync_width;
+	int vsync_width;
+	
+	int active_left;
+	int active_width;
+	
+	int fsc_left;
+	int fsc_width;
+	
+	int frame_rate_num;
+	int frame_rate_den;
+	
+	int frame;
+	int line;
+	
+	int fsc;
+	int fsc_hold;
+	
+	const int16_t *in;
+	int in_len;
+	int64_t in_pos;         /* Input index of *in */
+	
+	/* Blanking samples still to insert for dropped input, and
+	 * whether the current line has any */
+	int64_t gap;
+	int gap_line;
+	
+	/* Sample range of the current and last completed frame */
+	int64_t frame_first;
+	int64_t frame_last;
+	int frame_start;
+	
+	int16_t *iline;
+	int iline_len;
+	
+	/* The line decoder, specialised for the standard and geometry */
+	int (*decode)(struct _usbtv_t *s);
+	
+	/* Matched filter hsync. hprof is the correlation profile
+	 * averaged over recent lines, hsum the line's prefix sums */
+	int32_t *hsum;
+	float *hprof;
+	int hsync_offset;
+	
+	/* Vsync matching. vhist is the vsync level of recent lines (or
+	 * half-lines), newest first, vscore the last scores per pattern */
+	float vhist[USBTV_VSYNC_HIST];
+	float vscore[2][2];
+	int vsync_count;
+	
+	int sync_level;
+	int blank_level;
+	int porch_level;
+	int black_level;
+	int white_level;
+	
+	uint8_t *framebuffer;
+	int framebuffer_len;    /* In bytes */
+	int bytes_per_pixel;
+	
+	/* Acquisition. A frame of samples is buffered to estimate the
+	 * levels and find the sync phase, then replayed from acq_pos */
+	int acquire;
+	int16_t *acq;
+	int acq_size;
+	int acq_len;
+	int acq_pos;
+	
+	/* Skip rasterising the active lines. Sync, level
+	 * and FSC tracking continue to run as normal */
+	int skip;
+	
+	/* Horizontal decimation of the active lines, 1 for full
+	 * resolution. Each nth pixel is computed and repeated */
+	int decimate;
+	
+	/* Framebuffer rows rasterised since the last usbtv_dirty() */
+	int dirty_first;
+	int dirty_last;
+	
+	/* Lock statistics: lines decoded, lines with an hsync pulse
+	 * (not vsync or equalising), those with hsync within one
+	 * sample, and vsyncs found where they were expected */
+	int stat_lines;
+	int stat_hlines;
+	int stat_hlock;
+	int stat_vsync;
+	
+	/* Samples of dropped input skipped over by reacquiring,
+	 * rather than filled in with blanking */
+	int64_t stat_dropped;
+	
+	/* Metadata for the last decoded line */
+	usbtv_line_t info;
+	
+	/* Callbacks for usbtv_push() */
+	usbtv_line_cb_t line_cb;
+	usbtv_frame_cb_t frame_cb;
+	void *user;
+	
+} usbtv_t;
+
+extern int usbtv_init(usbtv_t *s, uint32_t sample_rate, int colour);
+extern void usbtv_free(usbtv_t *s);
+
+/* Drop tracking and reacquire the signal, e.g. after retuning. This
+ * happens automatically at startup and when vertical lock is lost */
+extern void usbtv_acquire(usbtv_t *s);
+
+/* Report samples lost from the input, before the next buffer written
+ * or pushed. The gap is filled with blanking so the line and field
+ * timing carry on, with sync tracking held over it. A gap of more
+ * than a frame reacquires the signal instead */
+extern void usbtv_gap(usbtv_t *s, int64_t samples);
+
+/* Pull interface. usbtv_write() lends the decoder a buffer, usbtv_read()
+ * then decodes one line at a time. It returns 0 after each line, 1 when
+ * a frame (or colour field) is complete and 2 once the buffer is used up */
+extern int usbtv_write(usbtv_t *s, const int16_t *buf, int samples);
+extern int usbtv_read(usbtv_t *s);
+
+/* Push interface. Decodes the whole buffer, calling the line
+ * and frame callbacks as each is completed. Either may be NULL */
+extern void usbtv_set_callbacks(usbtv_t *s, usbtv_line_cb_t line_cb, usbtv_frame_cb_t frame_cb, void *user);
+extern int usbtv_push(usbtv_t *s, const int16_t *buf, int samples);
+
+/* Lock quality since init, 0.0 (none) to 1.0 (perfect) */
+extern double usbtv_lock_quality(const usbtv_t *s);
+
+/* Run only the sync detector over the samples, one line at a time,
+ * for benchmarking it. Nothing is decoded, but the sync tracking
+ * state changes, so use a decoder set up for this. Returns the
+ * number of lines */
+extern int usbtv_sync_only(usbtv_t *s, const int16_t *buf, int samples);
+
+/* Describe the frame or field just completed by usbtv_read() */
+extern void usbtv_frame_info(const usbtv_t *s, usbtv_frame_t *frame);
+
+/* The framebuffer rows rasterised since the last call, to show the
+ * picture as it is decoded. Returns the number of rows from *first,
+ * which may include rows between those written, or 0 for none */
+extern int usbtv_dirty(usbtv_t *s, int *first);
+
+#endif
+